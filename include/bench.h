@@ -0,0 +1,35 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Cycle benchmark markers for the simulator harness (tools/simbench, unverified
+// scaffolding until simavr has an attiny202 core). A BENCH build writes the
+// marker id to GPIOR0 on entry and GPIOR1 on exit - one OUT instruction each -
+// and the harness timestamps both writes. A native BENCH build times them with
+// the host clock instead (src/hal_native.c). Other builds compile them away.
+
+#define BENCH_FRAME           1
+#define BENCH_DRAW_BOARD      2
+#define BENCH_DRAW_TILE_ROWS  3
+#define BENCH_TILE_FITS       4
+#define BENCH_UPDATE_TILE_POS 5
+#define BENCH_ADD_SCORE       6
+#define BENCH_KEY_SAMPLE      7
+#define BENCH_BOOT            8         // Reset to display on - time to first frame
+#define BENCH_MARKERS         16        // Ids below this are timed on the host
+#define BENCH_DONE            0xFF
+
+#if defined(BENCH) && defined(__AVR__)
+#include <avr/io.h>
+#define BENCH_BEGIN(id) (GPIOR0 = (id))
+#define BENCH_END(id)   (GPIOR1 = (id))
+#elif defined(BENCH)
+void halBenchBegin(uint8_t id);
+void halBenchEnd(uint8_t id);
+#define BENCH_BEGIN(id) halBenchBegin(id)
+#define BENCH_END(id)   halBenchEnd(id)
+#else
+#define BENCH_BEGIN(id)
+#define BENCH_END(id)
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef HAL_H
+#define HAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hardware abstraction for everything the game touches besides the display bus.
+// src/hal_avr.c drives the real ATtiny202 peripherals, src/hal_native.c mocks
+// them so the game logic can run as a host executable ([env:native]).
+
+#define HAL_KEYS_DIRECTIONAL 0  // AIN6 - Left / Right / Down
+#define HAL_KEYS_ROTATIONAL  1  // AIN7 - Rotate CCW / CW
+
+#define HAL_FRAME_HZ 60         // Frame tick rate, everything in the game is timed in frames
+
+// main() only ends in halHalt(), so on AVR it need not save registers for the C runtime
+#ifdef __AVR__
+#define HAL_MAIN __attribute__((OS_main))
+#else
+#define HAL_MAIN
+#endif
+
+void halInitKeys();
+void halInitTimer();
+uint8_t halWaitFrame();         // Sleeps until the next tick, returns the ticks elapsed since the last call
+void halHalt();                 // Stops the tick and the key scan, sleeps until reset
+
+// EEPROM (64 bytes). Writes must stay inside one 32 byte page; they only load the
+// page buffer and start the erase/write, which then finishes in the background.
+// A read waits for that write to complete.
+#define HAL_EEPROM_SIZE 64
+
+uint8_t halEepromRead(uint8_t addr);
+void halEepromWrite(uint8_t addr, const uint8_t *data, uint8_t len);
+
+#ifdef STACK_MONITOR
+// Free RAM is painted at reset, returns the bytes the stack has never reached
+uint8_t halStackUnused();
+#endif
+
+#ifdef POWER_STATS
+// Share of the frame time since the first halWaitFrame() the CPU was awake, in
+// percent, and the awake time of the busiest frame in percent of one frame period
+// (above 100 for a frame that ran late, capped at 255)
+uint8_t halAwakePercent();
+uint8_t halPeakAwakePercent();
+#endif
+
+// Boot entropy for the piece randomizer, never 0. Call it before halInitKeys(),
+// which sets the ADC up for the keys afterwards. Native and BENCH builds
+// return HAL_SCRIPT_SEED so every run deals the same pieces.
+#define HAL_SCRIPT_SEED 0xACE1
+uint16_t halRandomSeed();
+
+// Deterministic scripted or trace replayed key stream (native mock and BENCH
+// builds, see src/hal_script.c), call once per frame
+void halScriptKeys();
+
+// Implemented by the game - called once per key scan (frame tick ISR on AVR)
+void onKeySample(uint8_t pin, uint8_t result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
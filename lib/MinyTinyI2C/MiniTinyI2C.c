@@ -1,42 +1,77 @@
+#ifdef __AVR__
+
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "MiniTinyI2C.h"
 
-void initMiniTinyI2C(const uint16_t baud) {
-    //TWI0.MBAUD - Set baud rate
-    // Set MBAUD to get 100KHz for SCL from fSCL = CLK_PER / (10 + 2*BAUD + CLK_PER*Trise)
-    // uint32_t baud = ((F_CPU / 1000 / 100) - (((F_CPU * 1000) / 1000) / 1000) / 1000 - 10) / 2;
-    // 100kHz - Trise = 1000ns + 20MHz -> 0x55
-    // 400kHz - Trise = 300ns + 20MHz -> 0x11
-    // 1MHz - Trise   = 120ns + 20MHz-> 0x04 (980kHz) 0x03 (1087kHz)
-    switch (baud) {
-        case 100:
-            TWI0.MBAUD = 0x55; //100kHz 
-            break;
-        case 400:
-            TWI0.MBAUD = 0x11; //400kHz 
-            break;
-        case 800:
-            TWI0.MBAUD = 0x05; //800kHz 
-            break;
-        case 1100:
-            TWI0.CTRLA = TWI_FMPEN_bm;
-            TWI0.MBAUD = 0x03; //1100kHz 
-            break;
-    
-        default:
-            TWI0.MBAUD = 0x55; //100kHz 
-            break;
+#ifdef MINITINYI2C_ASYNC
+#define TWI_QUEUE_MASK (MINITINYI2C_QUEUE_SIZE - 1)
+#define TWI_QUEUE_IDLE   0                                      // No transaction on the bus
+#define TWI_QUEUE_OPEN   1                                      // Transaction open, more bytes may follow
+#define TWI_QUEUE_COMMIT 2                                      // STOP once the queue is drained
+
+volatile uint8_t gTWIQueue[MINITINYI2C_QUEUE_SIZE];
+volatile uint8_t gTWIQueueHead = 0;                             // Written by the caller
+volatile uint8_t gTWIQueueTail = 0;                             // Written by the ISR
+volatile uint8_t gTWIQueueState = TWI_QUEUE_IDLE;
+#endif
+
+#define TWI_ERRORS_bm (TWI_ARBLOST_bm | TWI_BUSERR_bm)            // Bus lost, no STOP of ours will do
+
+uint8_t gMiniTinyI2CErrors = 0;
+uint8_t gMiniTinyI2CNacks = 0;
+
+//Bounded wait for any of the MSTATUS flags. Returns the MSTATUS value that had
+//them, so the caller checks ACK and errors without reading it again, 0 on timeout.
+static inline uint8_t waitMiniTinyI2C(uint8_t flags) {
+    uint16_t timeout = MINITINYI2C_TIMEOUT;
+    uint8_t status;
+    while (!((status = TWI0.MSTATUS) & flags)) {
+        if (!--timeout) return 0;
     }
+    return status;
+}
+
+//Reset the master after a timeout, bus error or lost arbitration and take the
+//bus state back to idle so the next START can go out
+static void recoverMiniTinyI2C() {
+    gMiniTinyI2CErrors++;
+    TWI0.MCTRLB = TWI_FLUSH_bm;
+    TWI0.MSTATUS = TWI_BUSSTATE_IDLE_gc;
+}
+
+void initMiniTinyI2CBaud(uint8_t mbaud, bool fastModePlus) {
+    //TWI0.MBAUD - Set baud rate, see MINITINYI2C_MBAUD()
+    TWI0.CTRLA = fastModePlus ? TWI_FMPEN_bm : 0;
+    TWI0.MBAUD = mbaud;
 
     //TWI0.MSTATUS - Ox1 BUSSTATE - Set to Idle explicitly for I2C
     TWI0.MSTATUS = TWI_BUSSTATE_IDLE_gc; //Idle
 
     //TWI0.MCTRLA - Enable
     TWI0.MCTRLA = TWI_ENABLE_bm;
+
+#ifdef MINITINYI2C_ASYNC
+    sei();                                                      // Queue is drained from TWI0_TWIM_vect
+#endif
+}
+
+void sleepMiniTinyI2C() {
+    flushMiniTinyI2C();
+    TWI0.MCTRLA = 0;
+}
+
+void wakeMiniTinyI2C() {
+    TWI0.MCTRLA = TWI_ENABLE_bm;
+    TWI0.MSTATUS = TWI_BUSSTATE_IDLE_gc;
 }
 
 uint8_t readMiniTinyI2C(bool stop) {
-    while (!(TWI0.MSTATUS & TWI_RIF_bm));                       // Wait for read interrupt flag
+    uint8_t status = waitMiniTinyI2C(TWI_RIF_bm | TWI_ERRORS_bm);   // Wait for read interrupt flag or an error
+    if (!status || (status & TWI_ERRORS_bm)) {
+        recoverMiniTinyI2C();
+        return 0xFF;
+    }
 
     uint8_t data = TWI0.MDATA;
 
@@ -48,26 +83,208 @@ uint8_t readMiniTinyI2C(bool stop) {
   return data;
 }
 
-bool writeMiniTinyI2C(uint8_t data) {
-  
+//Per byte path of all writes: the MDATA store alone starts the transfer (no
+//MCTRLB command needed) and one MSTATUS read per poll covers WIF and RXACK
+static inline bool sendMiniTinyI2C(uint8_t data) {
     TWI0.MDATA = data;
-    TWI0.MCTRLB = TWI_MCMD_RECVTRANS_gc;                        // Do nothing
 
-    while (!(TWI0.MSTATUS & TWI_WIF_bm));                       // Wait for write interrupt flag
+    uint8_t status = waitMiniTinyI2C(TWI_WIF_bm | TWI_ERRORS_bm);   // Wait for write interrupt flag or an error
+    if (!status || (status & TWI_ERRORS_bm)) {
+        recoverMiniTinyI2C();
+        return false;
+    }
+
+    if (status & TWI_RXACK_bm) {
+        gMiniTinyI2CNacks++;
+        return false;
+    }
+    return true;                                                // Slave gave an ACK
+}
+
+bool writeMiniTinyI2C(uint8_t data) {
+    return sendMiniTinyI2C(data);
+}
 
-    return !(TWI0.MSTATUS & TWI_RXACK_bm);                      // Returns true if slave gave an ACK
+uint16_t writeBufferMiniTinyI2C(const uint8_t *data, uint16_t length) {
+    for (uint16_t i = 0; i < length; i++) {
+        if (!sendMiniTinyI2C(data[i])) return i;
+    }
+    return length;
+}
+
+uint16_t writeRepeatMiniTinyI2C(uint8_t data, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        if (!sendMiniTinyI2C(data)) return i;
+    }
+    return count;
 }
 
 bool startMiniTinyI2C(uint8_t address, bool read) {
-    TWI0.MADDR = address << 1 | read;                           // Send START condition
+    //A START that times out or loses the bus gets one more try after recovery
+    for (uint8_t attempt = 0; attempt < 2; attempt++) {
+        TWI0.MADDR = address << 1 | read;                       // Send START condition
+
+        uint8_t status = waitMiniTinyI2C(TWI_WIF_bm | TWI_RIF_bm);  // Wait for write or read interrupt flag
+        if (!status || (status & TWI_ERRORS_bm)) {
+            recoverMiniTinyI2C();
+            continue;
+        }
 
-    while (!(TWI0.MSTATUS & (TWI_WIF_bm | TWI_RIF_bm)));        // Wait for write or read interrupt flag
-    
-    if ((TWI0.MSTATUS & TWI_ARBLOST_bm))
-        return false;                                           // Return false if arbitration lost or bus error
-  return !(TWI0.MSTATUS & TWI_RXACK_bm);                        // Return true if slave gave an ACK
+        if (status & TWI_RXACK_bm) {
+            gMiniTinyI2CNacks++;
+            return false;                                       // No slave at this address
+        }
+        return true;
+    }
+    return false;
 }
 
 void stopMiniTinyI2C() {
   TWI0.MCTRLB = TWI_ACKACT_bm | TWI_MCMD_STOP_gc;               // Send STOP
 }
+
+#ifdef MINITINYI2C_ASYNC
+
+void beginMiniTinyI2C(uint8_t address) {
+    flushMiniTinyI2C();                                         // Previous transaction has to be on the wire
+    gTWIQueueHead = 0;                                          // ISR is parked, nothing stale survives an abort
+    gTWIQueueTail = 0;
+
+    gTWIQueueState = TWI_QUEUE_OPEN;
+    TWI0.MCTRLA = TWI_ENABLE_bm | TWI_WIEN_bm;
+    TWI0.MADDR = address << 1;                                  // Send START condition, WIF fires the ISR
+}
+
+//The ISR stopped making progress - the bus hangs. Drop the transaction.
+static void abortQueueMiniTinyI2C() {
+    TWI0.MCTRLA = TWI_ENABLE_bm;                                // No more ISR calls
+    recoverMiniTinyI2C();
+    gTWIQueueTail = gTWIQueueHead;
+    gTWIQueueState = TWI_QUEUE_IDLE;
+}
+
+void queueMiniTinyI2C(uint8_t data) {
+    if (gTWIQueueState == TWI_QUEUE_IDLE)
+        return;                                                 // Transaction aborted by a NACK
+
+    uint8_t head = (gTWIQueueHead + 1) & TWI_QUEUE_MASK;
+    uint16_t timeout = MINITINYI2C_TIMEOUT;
+    while (head == gTWIQueueTail) {                             // Queue full - wait for the ISR to make room
+        if (!--timeout) {
+            abortQueueMiniTinyI2C();
+            return;
+        }
+    }
+
+    //The ISR may have dropped the transaction since the check above, publish
+    //the byte only if it is still open
+    uint8_t sreg = CPU_SREG;
+    cli();
+    if (gTWIQueueState != TWI_QUEUE_IDLE) {
+        gTWIQueue[gTWIQueueHead] = data;
+        gTWIQueueHead = head;
+        TWI0.MCTRLA = TWI_ENABLE_bm | TWI_WIEN_bm;              // Wake the ISR if it parked on an empty queue
+    }
+    CPU_SREG = sreg;
+}
+
+void queueBufferMiniTinyI2C(const uint8_t *data, uint8_t length) {
+    while (length--) {
+        queueMiniTinyI2C(*data++);
+    }
+}
+
+void queueRepeatMiniTinyI2C(uint8_t data, uint16_t count) {
+    while (count--) {
+        queueMiniTinyI2C(data);
+    }
+}
+
+void commitMiniTinyI2C() {
+    //Same as queueMiniTinyI2C(): a NACK in the ISR must not be overwritten
+    uint8_t sreg = CPU_SREG;
+    cli();
+    if (gTWIQueueState != TWI_QUEUE_IDLE) {
+        gTWIQueueState = TWI_QUEUE_COMMIT;
+        TWI0.MCTRLA = TWI_ENABLE_bm | TWI_WIEN_bm;
+    }
+    CPU_SREG = sreg;
+}
+
+void flushMiniTinyI2C() {
+    //Wait for the STOP, the timeout restarts with every byte that goes out
+    uint8_t tail = gTWIQueueTail;
+    uint16_t timeout = MINITINYI2C_TIMEOUT;
+    while (gTWIQueueState != TWI_QUEUE_IDLE) {
+        if (tail != gTWIQueueTail) {
+            tail = gTWIQueueTail;
+            timeout = MINITINYI2C_TIMEOUT;
+        } else if (!--timeout) {
+            abortQueueMiniTinyI2C();
+            return;
+        }
+    }
+}
+
+ISR(TWI0_TWIM_vect) {
+    uint8_t tail = gTWIQueueTail;
+    uint8_t status = TWI0.MSTATUS;
+
+    if (status & TWI_ERRORS_bm) {
+        recoverMiniTinyI2C();                                   // Not our bus any more, no STOP
+        gTWIQueueTail = gTWIQueueHead;
+        gTWIQueueState = TWI_QUEUE_IDLE;
+        TWI0.MCTRLA = TWI_ENABLE_bm;
+        return;
+    } else if (status & TWI_RXACK_bm) {
+        gMiniTinyI2CNacks++;
+        tail = gTWIQueueHead;                                   // Drop the rest of the transaction
+    } else if (tail != gTWIQueueHead) {
+        TWI0.MDATA = gTWIQueue[tail];                           // Clears WIF, ISR fires again once sent
+        gTWIQueueTail = (tail + 1) & TWI_QUEUE_MASK;
+        return;
+    } else if (gTWIQueueState == TWI_QUEUE_OPEN) {
+        TWI0.MCTRLA = TWI_ENABLE_bm;                            // Park with SCL held until more bytes arrive
+        return;
+    }
+
+    TWI0.MCTRLB = TWI_ACKACT_bm | TWI_MCMD_STOP_gc;             // Send STOP
+    TWI0.MCTRLA = TWI_ENABLE_bm;
+    gTWIQueueTail = tail;
+    gTWIQueueState = TWI_QUEUE_IDLE;
+}
+
+#else
+
+bool gTWIAborted = false;                                       // Rest of the transaction is dropped
+
+void beginMiniTinyI2C(uint8_t address) {
+    gTWIAborted = !startMiniTinyI2C(address, false);
+}
+
+void queueMiniTinyI2C(uint8_t data) {
+    if (!gTWIAborted)
+        gTWIAborted = !sendMiniTinyI2C(data);
+}
+
+void queueBufferMiniTinyI2C(const uint8_t *data, uint8_t length) {
+    if (!gTWIAborted)
+        gTWIAborted = (writeBufferMiniTinyI2C(data, length) != length);
+}
+
+void queueRepeatMiniTinyI2C(uint8_t data, uint16_t count) {
+    if (!gTWIAborted)
+        gTWIAborted = (writeRepeatMiniTinyI2C(data, count) != count);
+}
+
+void commitMiniTinyI2C() {
+    if ((TWI0.MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_OWNER_gc)  // Not after a recovery
+        stopMiniTinyI2C();
+}
+
+void flushMiniTinyI2C() {
+}
+
+#endif
+
+#endif
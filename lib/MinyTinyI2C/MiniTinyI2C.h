@@ -2,15 +2,84 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 
-void initMiniTinyI2C(const uint16_t baud);
+#ifdef __AVR__
+// Bus rise time, set by the pull-ups and the bus capacitance of the board
+#ifndef MINITINYI2C_TRISE_NS
+#define MINITINYI2C_TRISE_NS 120
+#endif
+
+// fSCL = F_CPU / (10 + 2 * MBAUD + F_CPU * Trise) solved for MBAUD, rounded up
+// so SCL never ends up faster than asked for, and clamped at 0. Worked in
+// thousandths of a clock so a constant kHz folds at compile time:
+// 100kHz / 1000ns -> 0x55, 400kHz / 300ns -> 0x11, 1100kHz / 120ns -> 0x03 at 20MHz
+#define MINITINYI2C_MBAUD_X1000(kHz, triseNs) \
+    ((int32_t)((F_CPU) / (kHz)) - 10000 - (int32_t)((F_CPU) / 1000000 * (triseNs)))
+#define MINITINYI2C_MBAUD(kHz, triseNs) \
+    (MINITINYI2C_MBAUD_X1000(kHz, triseNs) > 0 ? (uint8_t)((MINITINYI2C_MBAUD_X1000(kHz, triseNs) + 1999) / 2000) : 0)
+
+#define MINITINYI2C_FMP_KHZ 400                                 // Faster than this needs Fast mode plus drive
+
+void initMiniTinyI2CBaud(uint8_t mbaud, bool fastModePlus);
+
+// Call with a constant so the baud calculation is done by the compiler
+static inline void initMiniTinyI2C(const uint16_t kHz) {
+    initMiniTinyI2CBaud(MINITINYI2C_MBAUD(kHz, MINITINYI2C_TRISE_NS), kHz > MINITINYI2C_FMP_KHZ);
+}
+#else
+void initMiniTinyI2C(const uint16_t kHz);
+#endif
+
+// Every wait on the bus gives up after this many status polls (~0.7ms at 20MHz,
+// several byte times even at 100kHz). The master is then flushed back to idle
+// and the rest of the transaction is dropped.
+#ifndef MINITINYI2C_TIMEOUT
+#define MINITINYI2C_TIMEOUT 2000
+#endif
+
+// Timeouts, bus errors and lost arbitration / NACKs seen since boot (wrap around)
+extern uint8_t gMiniTinyI2CErrors;
+extern uint8_t gMiniTinyI2CNacks;
+
+// Power the master down between transactions (SCL / SDA released to the pull-ups)
+// and back up with the baud rate it had. Sleep waits for queued bytes first.
+void sleepMiniTinyI2C();
+void wakeMiniTinyI2C();
+
 uint8_t readMiniTinyI2C(bool stop);
 bool writeMiniTinyI2C(uint8_t data);
 bool startMiniTinyI2C(uint8_t address, bool read);
 void stopMiniTinyI2C();
 
+// Burst writes inside a started transaction, without a function call per byte.
+// Return the index of the first byte that was not ACKed, length / count if all were.
+uint16_t writeBufferMiniTinyI2C(const uint8_t *data, uint16_t length);
+uint16_t writeRepeatMiniTinyI2C(uint8_t data, uint16_t count);
+
+// Queued write transactions. With MINITINYI2C_ASYNC the bytes go into a small
+// ring buffer that the TWI0 master interrupt feeds to MDATA, so the caller can
+// keep computing while the bus is busy. Without it they map onto the blocking
+// calls above. Don't mix with the blocking calls before flushMiniTinyI2C().
+#ifndef MINITINYI2C_QUEUE_SIZE
+#define MINITINYI2C_QUEUE_SIZE 16                               // Power of two
+#endif
+
+void beginMiniTinyI2C(uint8_t address);
+void queueMiniTinyI2C(uint8_t data);
+void queueBufferMiniTinyI2C(const uint8_t *data, uint8_t length);
+void queueRepeatMiniTinyI2C(uint8_t data, uint16_t count);
+void commitMiniTinyI2C();
+void flushMiniTinyI2C();
+
+#ifndef __AVR__
+// Traffic counters kept by the native mock backend
+extern uint32_t gMiniTinyI2CBytes;
+extern uint32_t gMiniTinyI2CTransactions;
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,87 @@
+#ifndef __AVR__
+
+// Mock TWI0 backend for [env:native]: nothing goes on a wire, every call
+// succeeds and the traffic is counted so renderer changes can be measured.
+// The bus has the SSD1306 model of lib/SSD1306Emu on it.
+
+#include "MiniTinyI2C.h"
+#include "SSD1306Emu.h"
+
+uint32_t gMiniTinyI2CBytes = 0;
+uint32_t gMiniTinyI2CTransactions = 0;
+uint8_t gMiniTinyI2CErrors = 0;
+uint8_t gMiniTinyI2CNacks = 0;
+
+void initMiniTinyI2C(const uint16_t kHz) {
+    (void)kHz;                                                  // The mock bus has no clock
+    gMiniTinyI2CBytes = 0;
+    gMiniTinyI2CTransactions = 0;
+}
+
+void sleepMiniTinyI2C() {
+}
+
+void wakeMiniTinyI2C() {
+}
+
+uint8_t readMiniTinyI2C(bool stop) {
+    (void)stop;
+    gMiniTinyI2CBytes++;
+    return 0xFF;
+}
+
+bool writeMiniTinyI2C(uint8_t data) {
+    gMiniTinyI2CBytes++;
+    ssd1306EmuWrite(data);
+    return true;
+}
+
+uint16_t writeBufferMiniTinyI2C(const uint8_t *data, uint16_t length) {
+    for (uint16_t i = 0; i < length; i++) {
+        writeMiniTinyI2C(data[i]);
+    }
+    return length;
+}
+
+uint16_t writeRepeatMiniTinyI2C(uint8_t data, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        writeMiniTinyI2C(data);
+    }
+    return count;
+}
+
+bool startMiniTinyI2C(uint8_t address, bool read) {
+    gMiniTinyI2CTransactions++;
+    gMiniTinyI2CBytes++;                                        // Address byte
+    ssd1306EmuStart(address, read);
+    return true;
+}
+
+void stopMiniTinyI2C() {
+    ssd1306EmuStop();
+}
+
+void beginMiniTinyI2C(uint8_t address) {
+    startMiniTinyI2C(address, false);
+}
+
+void queueMiniTinyI2C(uint8_t data) {
+    writeMiniTinyI2C(data);
+}
+
+void queueBufferMiniTinyI2C(const uint8_t *data, uint8_t length) {
+    writeBufferMiniTinyI2C(data, length);
+}
+
+void queueRepeatMiniTinyI2C(uint8_t data, uint16_t count) {
+    writeRepeatMiniTinyI2C(data, count);
+}
+
+void commitMiniTinyI2C() {
+    stopMiniTinyI2C();
+}
+
+void flushMiniTinyI2C() {
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef __AVR__
+
+#include <string.h>
+
+#include "SSD1306Emu.h"
+
+#define CONTROL_CO_bm 0x80                                      // One command / data byte, then a control byte again
+#define CONTROL_DC_bm 0x40                                      // Data (GDDRAM) instead of commands
+
+#define MODE_HORIZONTAL 0
+#define MODE_VERTICAL   1
+#define MODE_PAGE       2                                       // Reset default
+
+SSD1306EmuStats gSSD1306EmuTotal;
+SSD1306EmuStats gSSD1306EmuFrame;
+uint8_t gSSD1306EmuRam[SSD1306EMU_PAGES][SSD1306EMU_WIDTH];
+bool gSSD1306EmuOn = false;
+
+// Bus state of the current transaction
+bool gEmuSelected = false;                                      // Addressed with a write
+bool gEmuControl = false;                                       // Next byte is a control byte
+uint8_t gEmuMode = 0;                                           // Control byte in effect
+bool gEmuFrameChanged = false;
+
+// Command parser, arguments may arrive in separate Co pairs
+uint8_t gEmuCommand = 0;
+uint8_t gEmuArgs[6];
+uint8_t gEmuArgCount = 0;
+uint8_t gEmuArgsLeft = 0;
+
+// Addressing and display settings, reset values
+uint8_t gEmuAddressing = MODE_PAGE;
+uint8_t gEmuColumn[2] = { 0, SSD1306EMU_WIDTH - 1 };
+uint8_t gEmuPage[2] = { 0, SSD1306EMU_PAGES - 1 };
+uint8_t gEmuColumnPtr = 0;
+uint8_t gEmuPagePtr = 0;
+bool gEmuRemap = false;                                         // 0xA1: column 0 is SEG127
+bool gEmuComFlip = false;                                       // 0xC8: COM63 to COM0
+uint8_t gEmuStartLine = 0;
+uint8_t gEmuOffset = 0;
+
+static void countByte() {
+    gSSD1306EmuTotal.bytes++;
+    gSSD1306EmuFrame.bytes++;
+}
+
+// Argument bytes that follow each command, 0 for the rest
+static uint8_t commandArgs(uint8_t command) {
+    switch (command) {
+        case 0x20: case 0x81: case 0x8D: case 0xA8: case 0xD3:
+        case 0xD5: case 0xD9: case 0xDA: case 0xDB:
+            return 1;
+        case 0x21: case 0x22: case 0xA3:
+            return 2;
+        case 0x29: case 0x2A:
+            return 5;
+        case 0x26: case 0x27:
+            return 6;
+        default:
+            return 0;
+    }
+}
+
+static void runCommand(uint8_t command, const uint8_t *args) {
+    switch (command) {
+        case 0x20: gEmuAddressing = args[0] & 0x03; break;
+        case 0x21:
+            gEmuColumn[0] = args[0] & 0x7F;
+            gEmuColumn[1] = args[1] & 0x7F;
+            gEmuColumnPtr = gEmuColumn[0];
+            break;
+        case 0x22:
+            gEmuPage[0] = args[0] & 0x07;
+            gEmuPage[1] = args[1] & 0x07;
+            gEmuPagePtr = gEmuPage[0];
+            break;
+        case 0xA0: case 0xA1: gEmuRemap = command & 0x01; break;
+        case 0xC0: case 0xC8: gEmuComFlip = command & 0x08; break;
+        case 0xD3: gEmuOffset = args[0] & 0x3F; break;
+        case 0xAE: case 0xAF: gSSD1306EmuOn = command & 0x01; break;
+        default:
+            if (command >= 0x40 && command <= 0x7F) {
+                gEmuStartLine = command & 0x3F;
+            } else if (command >= 0xB0 && command <= 0xB7) {       // Page mode only
+                gEmuPagePtr = command & 0x07;
+            } else if (command <= 0x0F) {
+                gEmuColumnPtr = (gEmuColumnPtr & 0xF0) | command;
+            } else if (command <= 0x1F) {
+                gEmuColumnPtr = (gEmuColumnPtr & 0x0F) | ((command & 0x07) << 4);
+            }
+            break;
+    }
+}
+
+static void commandByte(uint8_t data) {
+    if (gEmuArgsLeft) {
+        gEmuArgs[gEmuArgCount++] = data;
+        if (!--gEmuArgsLeft)
+            runCommand(gEmuCommand, gEmuArgs);
+        return;
+    }
+
+    gEmuCommand = data;
+    gEmuArgCount = 0;
+    gEmuArgsLeft = commandArgs(data);
+    if (!gEmuArgsLeft)
+        runCommand(data, gEmuArgs);
+}
+
+// GDDRAM write and pointer advance of the current addressing mode
+static void dataByte(uint8_t data) {
+    uint8_t *cell = &gSSD1306EmuRam[gEmuPagePtr][gEmuColumnPtr];
+    gSSD1306EmuTotal.dataBytes++;
+    gSSD1306EmuFrame.dataBytes++;
+    if (*cell != data) {
+        *cell = data;
+        gSSD1306EmuTotal.changedBytes++;
+        gSSD1306EmuFrame.changedBytes++;
+        gEmuFrameChanged = true;
+    }
+
+    if (gEmuAddressing == MODE_PAGE) {
+        gEmuColumnPtr = (gEmuColumnPtr + 1) & (SSD1306EMU_WIDTH - 1);
+    } else if (gEmuAddressing == MODE_VERTICAL) {
+        if (gEmuPagePtr++ == gEmuPage[1]) {
+            gEmuPagePtr = gEmuPage[0];
+            gEmuColumnPtr = (gEmuColumnPtr == gEmuColumn[1]) ? gEmuColumn[0] : gEmuColumnPtr + 1;
+        }
+    } else {
+        if (gEmuColumnPtr++ == gEmuColumn[1]) {
+            gEmuColumnPtr = gEmuColumn[0];
+            gEmuPagePtr = (gEmuPagePtr == gEmuPage[1]) ? gEmuPage[0] : gEmuPagePtr + 1;
+        }
+    }
+}
+
+void ssd1306EmuStart(uint8_t address, bool read) {
+    gEmuSelected = (address == SSD1306EMU_ADDR && !read);      // Reads are not modelled
+    if (!gEmuSelected) return;
+
+    gEmuControl = true;
+    gSSD1306EmuTotal.transactions++;
+    gSSD1306EmuFrame.transactions++;
+    countByte();                                                // Address byte
+}
+
+void ssd1306EmuWrite(uint8_t data) {
+    if (!gEmuSelected) return;
+    countByte();
+
+    if (gEmuControl) {
+        gEmuMode = data;
+        gEmuControl = false;
+        return;
+    }
+
+    if (gEmuMode & CONTROL_DC_bm)
+        dataByte(data);
+    else
+        commandByte(data);
+
+    gEmuControl = (gEmuMode & CONTROL_CO_bm);
+}
+
+void ssd1306EmuStop() {
+    gEmuSelected = false;
+}
+
+bool ssd1306EmuPixel(uint8_t x, uint8_t y) {
+    uint8_t com = gEmuComFlip ? SSD1306EMU_HEIGHT - 1 - y : y;
+    uint8_t row = (com + gEmuStartLine + gEmuOffset) & (SSD1306EMU_HEIGHT - 1);
+    uint8_t column = gEmuRemap ? SSD1306EMU_WIDTH - 1 - x : x;
+    return (gSSD1306EmuRam[row >> 3][column] >> (row & 0x07)) & 1;
+}
+
+uint64_t ssd1306EmuHash() {
+    const uint8_t *ram = &gSSD1306EmuRam[0][0];
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (uint16_t i = 0; i < sizeof(gSSD1306EmuRam); i++) {
+        hash ^= ram[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+void ssd1306EmuWritePbm(FILE *out) {
+    fprintf(out, "P1\n%u %u\n", SSD1306EMU_WIDTH, SSD1306EMU_HEIGHT);
+    for (uint8_t y = 0; y < SSD1306EMU_HEIGHT; y++) {
+        for (uint8_t x = 0; x < SSD1306EMU_WIDTH; x++) {
+            fputc(ssd1306EmuPixel(x, y) ? '1' : '0', out);
+            if ((x & 0x3F) == 0x3F) fputc('\n', out);             // PBM lines stay under 70 characters
+        }
+    }
+}
+
+bool ssd1306EmuNextFrame() {
+    bool changed = gEmuFrameChanged;
+    gEmuFrameChanged = false;
+    memset(&gSSD1306EmuFrame, 0, sizeof(gSSD1306EmuFrame));
+    return changed;
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SSD1306EMU_H
+#define SSD1306EMU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Host model of a 128x64 SSD1306 on the I2C bus ([env:native] only). The mock
+// MiniTinyI2C backend hands it every START, byte and STOP exactly as the real
+// driver would put them on the wire, and it keeps the GDDRAM the panel would
+// end up with: control bytes (Co / D/C), the command argument lengths,
+// addressing modes 0x20, windows 0x21 / 0x22, page mode 0xB0 / 0x00 / 0x10,
+// segment remap 0xA0 / 0xA1, COM scan 0xC0 / 0xC8 and start line / offset for
+// the visible image. Scroll and the other settings only have their arguments
+// skipped.
+//
+// With it renderer changes can be checked to stay pixel identical (compare the
+// hashes or PBM snapshots) and their bus cost measured, without a panel.
+
+#define SSD1306EMU_ADDR    0x3C
+#define SSD1306EMU_WIDTH   128
+#define SSD1306EMU_HEIGHT  64
+#define SSD1306EMU_PAGES   (SSD1306EMU_HEIGHT / 8)
+
+typedef struct {
+    uint32_t transactions;      // STARTs to the panel address
+    uint32_t bytes;             // Address, control, command and data bytes
+    uint32_t dataBytes;         // GDDRAM writes
+    uint32_t changedBytes;      // GDDRAM writes that changed the RAM
+} SSD1306EmuStats;
+
+extern SSD1306EmuStats gSSD1306EmuTotal;
+extern SSD1306EmuStats gSSD1306EmuFrame;    // Since the last ssd1306EmuNextFrame()
+extern uint8_t gSSD1306EmuRam[SSD1306EMU_PAGES][SSD1306EMU_WIDTH];
+extern bool gSSD1306EmuOn;                  // 0xAF / 0xAE
+
+// Bus side, called by the mock I2C backend
+void ssd1306EmuStart(uint8_t address, bool read);
+void ssd1306EmuWrite(uint8_t data);
+void ssd1306EmuStop();
+
+// Visible pixel at x, y (0, 0 = top left) with remap, scan direction and start line applied
+bool ssd1306EmuPixel(uint8_t x, uint8_t y);
+
+// FNV-1a over the GDDRAM, equal hashes = identical image
+uint64_t ssd1306EmuHash();
+
+// Plain PBM (P1) of the visible image
+void ssd1306EmuWritePbm(FILE *out);
+
+// Closes the per frame counters, true if the GDDRAM changed during the frame
+bool ssd1306EmuNextFrame();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,32 @@
+# PlatformIO post action: per symbol .data/.bss usage of the firmware image.
+# The ATtiny202 only has 128 bytes of SRAM, so print where every byte goes.
+
+Import("env")
+
+import subprocess
+
+RAM_SIZE = 128
+
+
+def ram_report(source, target, env):
+    elf = str(target[0])
+    nm = env.subst("$CC").replace("gcc", "nm")
+    out = subprocess.run([nm, "--size-sort", "-S", "-t", "d", elf],
+                         capture_output=True, text=True, check=True).stdout
+
+    symbols = []
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) != 4 or fields[2] not in "dDbB":
+            continue
+        section = ".data" if fields[2] in "dD" else ".bss"
+        symbols.append((int(fields[1]), section, fields[3]))
+
+    total = sum(size for size, _, _ in symbols)
+    print("RAM usage by symbol (%s)" % elf)
+    for size, section, name in sorted(symbols, reverse=True):
+        print("  %4d  %-5s  %s" % (size, section, name))
+    print("  %4d  total static, %d bytes left for the stack" % (total, RAM_SIZE - total))
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", ram_report)
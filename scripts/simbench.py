@@ -0,0 +1,36 @@
+# PlatformIO custom target: `pio run -e bench -t simbench`
+# Builds tools/simbench against libsimavr, runs the BENCH firmware to
+# completion and leaves the per marker cycle counts in bench_results.json and
+# the per frame costs in bench_frames.csv.
+#
+# Unverified scaffolding: upstream simavr has no attiny202 core, so the run
+# fails until one is provided (see the header of tools/simbench/simbench.c).
+
+Import("env")
+
+import os
+import subprocess
+
+
+def simbench(source, target, env):
+    project = env.subst("$PROJECT_DIR")
+    build = env.subst("$BUILD_DIR")
+    harness = os.path.join(build, "simbench")
+    elf = os.path.join(build, env.subst("${PROGNAME}.elf"))
+
+    subprocess.run(["cc", "-O2", "-o", harness,
+                    os.path.join(project, "tools", "simbench", "simbench.c"),
+                    "-lsimavr", "-lelf"], check=True)
+    subprocess.run([harness, "-m", env.BoardConfig().get("build.mcu"),
+                    "-f", env.subst("$BOARD_F_CPU").rstrip("L"),
+                    "-o", os.path.join(project, "bench_results.json"),
+                    "-c", os.path.join(project, "bench_frames.csv"), elf],
+                   check=True)
+
+
+env.AddCustomTarget(
+    name="simbench",
+    dependencies="$BUILD_DIR/${PROGNAME}.elf",
+    actions=simbench,
+    title="Simulator benchmark",
+    description="Cycle counts of the instrumented hot paths under simavr")
@@ -0,0 +1,270 @@
+#ifdef __AVR__
+
+#ifndef F_CPU
+#define F_CPU 20000000L                                         // board_build.f_cpu in platformio.ini
+#endif
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/cpufunc.h>
+
+#include "hal.h"
+#include "bench.h"
+
+#define ADC_DIRECTIONAL_PIN ADC_MUXPOS_AIN6_gc
+#define ADC_ROTATIONAL_PIN  ADC_MUXPOS_AIN7_gc                 // MUXPOS is the pin being scanned
+
+//Keys are sampled at the frame rate instead of converting back to back. Free-run
+//could only watch one MUXPOS channel and the buttons sit on two ladders, so the
+//frame tick starts a single accumulated conversion. By the next tick it is long
+//done and the window comparator flag tells a pressed button from the idle level,
+//so the ADC never interrupts and the tick is the only ISR that calls the game.
+#define KEYS_SAMPNUM       ADC_SAMPNUM_ACC4_gc
+#define KEYS_RESULT_SHIFT  4                                    // 4 x 10 bit -> 8 bit reading
+#define KEYS_IDLE_MAX      0x20                                 // Ladder idles at GND, buttons read 0x57 and up
+
+//TCA0 runs from CLK_PER / 64, one overflow per frame
+#define FRAME_TIMER_PER ((F_CPU / 64 / HAL_FRAME_HZ) - 1)
+
+#define FRAME_TICKS GPIOR0                                      // Counted by the ISR in a free I/O register, no RAM
+uint8_t gFrameLast = 0;
+
+void halInitKeys() {
+    //Set ADC to VDD reference voltage and prescaler to 16 divisor (20/16 = 1.25MHz)
+    ADC0.CTRLC = ADC_SAMPCAP_bm | ADC_REFSEL_VDDREF_gc | ADC_PRESC_DIV16_gc;
+
+    //Accumulate 4 samples per conversion to filter ladder noise
+    ADC0.CTRLB = KEYS_SAMPNUM;
+
+    //Configure ADC on pin 2 (AIN6) - direction and drop
+    //Turn off Digital input buffer
+    PORTA.PIN2CTRL = PORT_ISC_INPUT_DISABLE_gc;
+
+    //Configure ADC on pin 3 (AIN7) - rotations
+    //Turn off Digital input buffer
+    PORTA.PIN3CTRL = PORT_ISC_INPUT_DISABLE_gc;
+
+    //Window comparator - only results above the idle level raise the WCMP flag
+    ADC0.WINHT = (uint16_t)KEYS_IDLE_MAX << KEYS_RESULT_SHIFT;
+    ADC0.CTRLE = ADC_WINCM_ABOVE_gc;
+
+    //Enable global interrupts
+    CPU_SREG |= 0b10000000;
+
+    //Clear flags (Write 1 to clear!), the ADC interrupts stay off
+    ADC0.INTFLAGS = ADC_WCMP_bm | ADC_RESRDY_bm;
+
+    //10bit ADC and enable
+    ADC0.CTRLA = ADC_RESSEL_10BIT_gc | ADC_ENABLE_bm;
+
+    //Default to AIN6 pin, the frame tick starts the conversions
+    ADC0.MUXPOS = ADC_DIRECTIONAL_PIN;
+}
+
+uint8_t currentKeysPin() {
+    return (ADC0.MUXPOS == ADC_DIRECTIONAL_PIN) ? HAL_KEYS_DIRECTIONAL : HAL_KEYS_ROTATIONAL;
+}
+
+//Called from the frame tick - one accumulated conversion per frame, alternating pins
+void scanKeys() {
+    //Result of the last tick's conversion, no window hit means the button is up
+    uint8_t result = 0x00;
+    if (ADC0.INTFLAGS & ADC_WCMP_bm)
+        result = ADC0.RES >> KEYS_RESULT_SHIFT;
+    ADC0.INTFLAGS = ADC_WCMP_bm | ADC_RESRDY_bm;
+    onKeySample(currentKeysPin(), result);
+
+    ADC0.MUXPOS = (ADC0.MUXPOS == ADC_DIRECTIONAL_PIN) ? ADC_ROTATIONAL_PIN : ADC_DIRECTIONAL_PIN;
+
+    //Start conversion!
+    ADC0.COMMAND = ADC_STCONV_bm;
+}
+
+void halInitTimer() {
+#ifdef BENCH
+    //No tick in the benchmark, its ISR would land inside the measured sections
+#else
+    TCA0.SINGLE.PER = FRAME_TIMER_PER;
+    TCA0.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
+    TCA0.SINGLE.INTCTRL = TCA_SINGLE_OVF_bm;
+    TCA0.SINGLE.CTRLA = TCA_SINGLE_CLKSEL_DIV64_gc | TCA_SINGLE_ENABLE_bm;
+
+    //Idle keeps TWI, ADC and TCA0 running while the CPU waits for the tick
+    SLPCTRL.CTRLA = SLPCTRL_SMODE_IDLE_gc | SLPCTRL_SEN_bm;
+#endif
+}
+
+ISR(TCA0_OVF_vect) {
+    FRAME_TICKS++;
+    scanKeys();
+
+    //Clear overflow interrupt (Write 1 to clear!)
+    TCA0.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
+}
+
+#ifdef POWER_STATS
+uint32_t gAwakeTicks = 0;                                       // Timer ticks spent out of sleep
+uint32_t gTimedTicks = 0;                                       // All timer ticks since the first frame wait
+uint16_t gPeakAwakeTicks = 0;                                   // Busiest frame
+uint8_t gWakeTick = 0;                                          // Timer position when the last wait returned
+uint16_t gWakeCnt = 0;
+
+//Frame tick and count into it, with an overflow the ISR has not taken yet
+//already counted. Interrupts are off.
+uint8_t timerPosition(uint16_t *cnt) {
+    uint8_t ticks = FRAME_TICKS;
+    *cnt = TCA0.SINGLE.CNT;
+    if (TCA0.SINGLE.INTFLAGS & TCA_SINGLE_OVF_bm) {
+        ticks++;
+        *cnt = TCA0.SINGLE.CNT;
+    }
+    return ticks;
+}
+
+//Awake from the wake sample to here, right before the frame goes to sleep.
+//Good to a timer tick (64 CPU cycles). The tick ISR that ends the sleep and
+//the TWI ISRs that run during it still count as asleep.
+void countAwakeTicks() {
+    uint16_t cnt;
+    uint8_t ticks = timerPosition(&cnt) - gWakeTick;
+    uint32_t awake = (uint32_t)ticks * (FRAME_TIMER_PER + 1) + cnt - gWakeCnt;
+    if (!gTimedTicks) return;                                   // Boot frame, no wake sample yet
+    gAwakeTicks += awake;
+    if (awake > gPeakAwakeTicks)
+        gPeakAwakeTicks = (awake > 0xFFFF) ? 0xFFFF : awake;
+}
+
+uint8_t halAwakePercent() {
+    return gTimedTicks ? gAwakeTicks / ((gTimedTicks + 99) / 100) : 0;
+}
+
+uint8_t halPeakAwakePercent() {
+    uint16_t percent = (uint32_t)gPeakAwakeTicks * 100 / (FRAME_TIMER_PER + 1);
+    return (percent > 0xFF) ? 0xFF : percent;
+}
+#endif
+
+#ifdef BENCH
+//Simulator benchmark: frames run back to back on scripted keys, so the cycle
+//counts only depend on the game and renderer code
+uint8_t halWaitFrame() {
+    halScriptKeys();
+    return 1;
+}
+#else
+uint8_t halWaitFrame() {
+    cli();
+#ifdef POWER_STATS
+    countAwakeTicks();
+#endif
+    while (FRAME_TICKS == gFrameLast) {
+        sei();                                                  // Sleep executes before any pending interrupt
+        sleep_cpu();
+        cli();
+    }
+#ifdef POWER_STATS
+    gWakeTick = timerPosition(&gWakeCnt);
+#endif
+    sei();
+
+    //Ticks are counted in hardware, a late frame just sees more than one
+    uint8_t now = FRAME_TICKS;
+    uint8_t elapsed = now - gFrameLast;
+    gFrameLast = now;
+#ifdef POWER_STATS
+    gTimedTicks += (uint32_t)elapsed * (FRAME_TIMER_PER + 1);
+#endif
+    return elapsed;
+}
+#endif
+
+//Seed noise: LSBs of the temperature sensor converted far above the rated ADC clock
+#define SEED_SAMPLES 16
+
+uint16_t halRandomSeed() {
+#ifdef BENCH
+    return HAL_SCRIPT_SEED;
+#else
+    uint16_t seed = 0;
+
+    //Runs before halInitKeys(), which sets every ADC register it needs again
+    ADC0.CTRLC = ADC_REFSEL_INTREF_gc | ADC_PRESC_DIV2_gc;
+    ADC0.MUXPOS = ADC_MUXPOS_TEMPSENSE_gc;
+    ADC0.CTRLA = ADC_ENABLE_bm;
+
+    for (uint8_t i = 0; i < SEED_SAMPLES; i++) {
+        ADC0.COMMAND = ADC_STCONV_bm;
+        while (!(ADC0.INTFLAGS & ADC_RESRDY_bm));
+        seed = ((seed << 1) | (seed >> 15)) ^ ADC0.RES;         //Reading RES clears RESRDY
+    }
+
+    return seed ? seed : HAL_SCRIPT_SEED;
+#endif
+}
+
+uint8_t halEepromRead(uint8_t addr) {
+    //EEPROM is memory mapped, a read is a plain load once no write is in flight
+    while (NVMCTRL.STATUS & NVMCTRL_EEBUSY_bm);
+    return *(volatile uint8_t *)(EEPROM_START + addr);
+}
+
+void halEepromWrite(uint8_t addr, const uint8_t *data, uint8_t len) {
+    //Only a write still in flight holds us up
+    while (NVMCTRL.STATUS & NVMCTRL_EEBUSY_bm);
+
+    //Stores to the mapped EEPROM fill the page buffer
+    for (uint8_t i = 0; i < len; i++) {
+        *(volatile uint8_t *)(EEPROM_START + addr + i) = data[i];
+    }
+
+    //Erase/write only the loaded bytes, the CPU carries on meanwhile
+    _PROTECTED_WRITE_SPM(NVMCTRL.CTRLA, NVMCTRL_CMD_PAGEERASEWRITE_gc);
+}
+
+#ifdef STACK_MONITOR
+#define STACK_PAINT 0xC5
+
+extern uint8_t _end;
+extern uint8_t __stack;
+
+//Runs before the C runtime is set up, so no C and no stack - paint _end up to __stack
+void paintStack() __attribute__ ((naked, used, section (".init1")));
+void paintStack() {
+    __asm volatile (
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :: "M" (STACK_PAINT));
+}
+
+uint8_t halStackUnused() {
+    const uint8_t *p = &_end;
+    while (p <= &__stack && *p == STACK_PAINT) p++;
+    return p - &_end;
+}
+#endif
+
+void halHalt() {
+    BENCH_BEGIN(BENCH_DONE);
+
+    //Nothing left to wake up for: frame tick and ADC off, the deepest sleep
+    //with interrupts off only ends with a reset
+    cli();
+    TCA0.SINGLE.CTRLA = 0;
+    ADC0.CTRLA = 0;
+    SLPCTRL.CTRLA = SLPCTRL_SMODE_PDOWN_gc | SLPCTRL_SEN_bm;
+    while(1) {
+        sleep_cpu();
+    }
+}
+
+#endif
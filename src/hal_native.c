@@ -0,0 +1,180 @@
+#ifndef __AVR__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hal.h"
+#include "bench.h"
+#include "MiniTinyI2C.h"
+#include "SSD1306Emu.h"
+
+uint32_t gHalFrames = 0;
+uint8_t gMockEeprom[HAL_EEPROM_SIZE] = { [0 ... HAL_EEPROM_SIZE - 1] = 0xFF };   // Erased
+clock_t gHalStartClock = 0;
+uint32_t gHalBootBytes = 0;                                     // Bus traffic up to the first frame
+uint32_t gHalBootTransactions = 0;
+
+// Per frame cost report (TT_FRAME_CSV=<file>): bus traffic of every frame, host
+// time between the frame waits and, in BENCH builds, host time spent in the
+// instrumented functions
+FILE *gHalFrameCsv = NULL;
+uint32_t gHalFrameBytes = 0;                                    // Counters at the start of the frame
+uint32_t gHalFrameTransactions = 0;
+uint64_t gHalBenchStart[BENCH_MARKERS];
+uint64_t gHalBenchNs[BENCH_MARKERS];                            // Spent in the current frame
+uint64_t gHalWakeNs = 0;                                        // When the last frame wait returned
+uint64_t gHalFrameAwakeNs = 0;
+uint64_t gHalAwakeNs = 0;                                       // All frames but the boot one
+uint64_t gHalPeakAwakeNs = 0;
+
+// Display snapshots from the SSD1306 model: TT_PBM=<file> the final image,
+// TT_PBM_DIR=<dir> one frame_NNNNN.pbm for every frame that changed the GDDRAM
+const char *gHalPbmDir = NULL;
+
+uint64_t halNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+void halBenchBegin(uint8_t id) {
+    if (id < BENCH_MARKERS) gHalBenchStart[id] = halNanoseconds();
+}
+
+void halBenchEnd(uint8_t id) {
+    if (id < BENCH_MARKERS) gHalBenchNs[id] += halNanoseconds() - gHalBenchStart[id];
+}
+
+void halWritePbm(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        exit(1);
+    }
+    ssd1306EmuWritePbm(out);
+    fclose(out);
+}
+
+// Row for the frame that just ended, frame 0 is everything up to the first tick
+void halFrameReport() {
+    //The host never sleeps, awake is the time the game took to get back to the wait
+    uint64_t now = halNanoseconds();
+    gHalFrameAwakeNs = now - gHalWakeNs;
+    if (gHalFrames) {
+        gHalAwakeNs += gHalFrameAwakeNs;
+        if (gHalFrameAwakeNs > gHalPeakAwakeNs) gHalPeakAwakeNs = gHalFrameAwakeNs;
+    }
+
+    SSD1306EmuStats display = gSSD1306EmuFrame;
+    if (ssd1306EmuNextFrame() && gHalPbmDir) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/frame_%05lu.pbm", gHalPbmDir, (unsigned long)gHalFrames);
+        halWritePbm(path);
+    }
+
+    if (!gHalFrameCsv) return;
+
+    fprintf(gHalFrameCsv, "%lu,%lu,%lu,%lu,%lu,%llu,%llu,%llu\n", (unsigned long)gHalFrames,
+        (unsigned long)(gMiniTinyI2CBytes - gHalFrameBytes),
+        (unsigned long)(gMiniTinyI2CTransactions - gHalFrameTransactions),
+        (unsigned long)display.dataBytes,
+        (unsigned long)display.changedBytes,
+        (unsigned long long)gHalFrameAwakeNs,
+        (unsigned long long)gHalBenchNs[BENCH_DRAW_TILE_ROWS],
+        (unsigned long long)gHalBenchNs[BENCH_UPDATE_TILE_POS]);
+
+    gHalFrameBytes = gMiniTinyI2CBytes;
+    gHalFrameTransactions = gMiniTinyI2CTransactions;
+    memset(gHalBenchNs, 0, sizeof(gHalBenchNs));
+}
+
+void halInitKeys() {
+    gHalStartClock = clock();
+    gHalWakeNs = halNanoseconds();
+    gHalPbmDir = getenv("TT_PBM_DIR");
+
+    const char *csv = getenv("TT_FRAME_CSV");
+    if (csv) {
+        if (!(gHalFrameCsv = fopen(csv, "w"))) {
+            perror(csv);
+            exit(1);
+        }
+        fprintf(gHalFrameCsv, "frame,i2c_bytes,i2c_transactions,display_data_bytes,display_changed_bytes,awake_ns,draw_tile_rows_ns,update_tile_pos_ns\n");
+    }
+}
+
+void halInitTimer() {
+}
+
+// Virtual clock: every call is exactly one frame later, keys come from the script
+uint8_t halWaitFrame() {
+    if (!gHalFrames) {
+        gHalBootBytes = gMiniTinyI2CBytes;
+        gHalBootTransactions = gMiniTinyI2CTransactions;
+    }
+    halFrameReport();
+    gHalFrames++;
+    halScriptKeys();
+    gHalWakeNs = halNanoseconds();
+    return 1;
+}
+
+#ifdef POWER_STATS
+uint8_t halAwakePercent() {
+    uint64_t timed = (uint64_t)(gHalFrames - 1) * 1000000000u / HAL_FRAME_HZ;
+    return gHalFrames > 1 ? gHalAwakeNs * 100 / timed : 0;
+}
+
+uint8_t halPeakAwakePercent() {
+    uint64_t percent = gHalPeakAwakeNs * 100 * HAL_FRAME_HZ / 1000000000u;
+    return percent > 0xFF ? 0xFF : percent;
+}
+#endif
+
+uint16_t halRandomSeed() {
+    return HAL_SCRIPT_SEED;
+}
+
+uint8_t halEepromRead(uint8_t addr) {
+    return gMockEeprom[addr];
+}
+
+void halEepromWrite(uint8_t addr, const uint8_t *data, uint8_t len) {
+    memcpy(&gMockEeprom[addr], data, len);
+}
+
+#ifdef STACK_MONITOR
+uint8_t halStackUnused() {
+    return 0;                                                   // Not measured on the host
+}
+#endif
+
+void halHalt() {
+    halFrameReport();
+    if (gHalFrameCsv) fclose(gHalFrameCsv);
+
+    double hostMs = (double)(clock() - gHalStartClock) * 1000.0 / CLOCKS_PER_SEC;
+
+    printf("game time      : %lu frames (%lu ms)\n", (unsigned long)gHalFrames,
+        (unsigned long)(gHalFrames * 1000 / HAL_FRAME_HZ));
+    printf("host cpu time  : %.3f ms\n", hostMs);
+    printf("boot i2c       : %lu bytes, %lu start\n", (unsigned long)gHalBootBytes,
+        (unsigned long)gHalBootTransactions);
+    printf("i2c bytes      : %lu\n", (unsigned long)gMiniTinyI2CBytes);
+    printf("i2c start      : %lu\n", (unsigned long)gMiniTinyI2CTransactions);
+    printf("host awake     : %.3f%% of the frame time\n",
+        gHalFrames > 1 ? gHalAwakeNs * 100.0 * HAL_FRAME_HZ / ((gHalFrames - 1) * 1e9) : 0.0);
+    printf("host peak frame: %.3f%% of a frame\n", gHalPeakAwakeNs * 100.0 * HAL_FRAME_HZ / 1e9);
+    printf("display data   : %lu bytes, %lu changed the GDDRAM\n",
+        (unsigned long)gSSD1306EmuTotal.dataBytes, (unsigned long)gSSD1306EmuTotal.changedBytes);
+    printf("display hash   : %016llx\n", (unsigned long long)ssd1306EmuHash());
+
+    const char *pbm = getenv("TT_PBM");
+    if (pbm) halWritePbm(pbm);
+    exit(0);
+}
+
+#endif
@@ -0,0 +1,139 @@
+#if !defined(__AVR__) || defined(BENCH)
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hal.h"
+#include "bench.h"
+
+#ifndef __AVR__
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+
+// Scripted keys: instead of a resistor ladder the game is fed raw ADC readings
+// through onKeySample(), so the native mock and the simulator benchmark build
+// play the same game on every run. The readings come from one of:
+//  - a deterministic pseudo random stream, one directional and one rotational
+//    sample every few frames (default)
+//  - a recorded input trace, from a host file (native, TT_TRACE_IN=<file>) or
+//    compiled into flash (-DSCRIPT_TRACE=\"<file>\")
+// Native builds can also record every sample they feed (TT_TRACE_OUT=<file>).
+//
+// A trace is one event per line, written as a C initializer so the same file
+// can be replayed from a host file or #included into a flash table:
+//   { frame, pin, value },
+#define SCRIPT_TICK_FRAMES 6
+#define SCRIPT_ADC_IDLE    0x00
+
+const uint8_t scriptDirectionalValues[4] = { 0xD5, 0x57, 0x7F, SCRIPT_ADC_IDLE };  // Left, Right, Down, none
+const uint8_t scriptRotationalValues[4]  = { 0x7F, 0xD5, SCRIPT_ADC_IDLE, SCRIPT_ADC_IDLE };  // CCW, CW, none
+
+uint32_t gScriptState = 0x2545F491;
+uint8_t gScriptFrames = 0;
+uint16_t gScriptFrame = 0;                                      // Frames since boot, the trace time base
+
+typedef struct {
+    uint16_t frame;
+    uint8_t pin;
+    uint8_t value;
+} ScriptEvent;
+
+#ifdef SCRIPT_TRACE
+const ScriptEvent scriptTrace[] = {
+#include SCRIPT_TRACE
+};
+#define SCRIPT_TRACE_LENGTH (sizeof(scriptTrace) / sizeof(scriptTrace[0]))
+uint16_t gScriptTraceIndex = 0;
+#endif
+
+#ifndef __AVR__
+FILE *gScriptIn = NULL;
+FILE *gScriptOut = NULL;
+ScriptEvent gScriptNext;
+bool gScriptPending = false;                                    // gScriptNext holds an unplayed event
+bool gScriptOpened = false;
+#endif
+
+void scriptSample(uint8_t pin, uint8_t value) {
+#ifndef __AVR__
+    if (gScriptOut)
+        fprintf(gScriptOut, "{ %u, %u, 0x%02X },\n", gScriptFrame, pin, value);
+#endif
+    BENCH_BEGIN(BENCH_KEY_SAMPLE);
+    onKeySample(pin, value);
+    BENCH_END(BENCH_KEY_SAMPLE);
+}
+
+void scriptRandomKeys() {
+    if (++gScriptFrames < SCRIPT_TICK_FRAMES) return;
+    gScriptFrames = 0;
+
+    gScriptState = gScriptState * 1664525 + 1013904223;
+    uint8_t r = gScriptState >> 24;
+    scriptSample(HAL_KEYS_DIRECTIONAL, scriptDirectionalValues[r & 0x03]);
+    scriptSample(HAL_KEYS_ROTATIONAL, scriptRotationalValues[(r >> 2) & 0x03]);
+}
+
+#ifndef __AVR__
+bool scriptReadEvent(ScriptEvent *event) {
+    char line[64];
+    unsigned frame, pin, value;
+
+    while (fgets(line, sizeof(line), gScriptIn)) {
+        if (sscanf(line, " { %u , %u , %x }", &frame, &pin, &value) == 3) {
+            event->frame = frame;
+            event->pin = pin;
+            event->value = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void scriptOpen() {
+    const char *in = getenv("TT_TRACE_IN");
+    const char *out = getenv("TT_TRACE_OUT");
+
+    if (in && !(gScriptIn = fopen(in, "r"))) {
+        perror(in);
+        exit(1);
+    }
+    if (out && !(gScriptOut = fopen(out, "w"))) {
+        perror(out);
+        exit(1);
+    }
+}
+#endif
+
+void halScriptKeys() {
+#ifndef __AVR__
+    if (!gScriptOpened) {
+        scriptOpen();
+        gScriptOpened = true;
+    }
+
+    if (gScriptIn) {
+        //Every event due this frame, the trace ends with the file
+        while (gScriptPending || scriptReadEvent(&gScriptNext)) {
+            gScriptPending = (gScriptNext.frame > gScriptFrame);
+            if (gScriptPending) break;
+            scriptSample(gScriptNext.pin, gScriptNext.value);
+        }
+        gScriptFrame++;
+        return;
+    }
+#endif
+
+#ifdef SCRIPT_TRACE
+    while (gScriptTraceIndex < SCRIPT_TRACE_LENGTH && scriptTrace[gScriptTraceIndex].frame <= gScriptFrame) {
+        scriptSample(scriptTrace[gScriptTraceIndex].pin, scriptTrace[gScriptTraceIndex].value);
+        gScriptTraceIndex++;
+    }
+#else
+    scriptRandomKeys();
+#endif
+    gScriptFrame++;
+}
+
+#endif
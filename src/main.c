@@ -1,22 +1,24 @@
-#undef F_CPU
-#define F_CPU 20000000
-
 #include <stdint.h>
-#include <avr/io.h>
-#include <util/delay.h>
 #include <string.h>
 #include <stdlib.h>
-#include <avr/interrupt.h>
 
 #include <MiniTinyI2C.h>
+#include "hal.h"
+#include "bench.h"
 
 #define LCD_I2C_ADDR            0x3C
 #define LCD_COMMAND             0x00
+#define LCD_COMMAND_CONTINUE    0x80    // Co bit - a control byte follows the next command byte
 #define LCD_COMMAND_PAGE_ADDR   0x22
 #define LCD_COMMAND_COLUMN_ADDR 0x21
 #define LCD_DATA                0x40
 
-#define INIT_LENGTH 28
+#define LCD_COMMAND_DISPLAY_ON  0xAF
+#define LCD_COMMAND_DISPLAY_OFF 0xAE
+#define LCD_COLUMNS             128
+#define LCD_PAGES               8
+
+#define INIT_LENGTH 27
 
 const uint8_t DisplayInit[INIT_LENGTH] = {
   0xE4,             // Soft Reset
@@ -25,7 +27,7 @@ const uint8_t DisplayInit[INIT_LENGTH] = {
   0xD3, 0x00,       // Display offset to 0
   0x40,             // Set display start line to 0
   0x8D, 0x14,       // Charge pump enabled
-  0x20, 0x00,       // Memory addressing mode 0x00 Horizontal 0x01 Vertical
+  0x20, 0x01,       // Memory addressing mode 0x00 Horizontal 0x01 Vertical - the board is drawn sideways, see drawBoard()
   0xDA, 0x12,       // Set COM Pins hardware configuration to sequential
   0x81, 0xA0,       // Set contrast
   0xD9, 0xFF,       // Set pre-charge period
@@ -38,55 +40,66 @@ const uint8_t DisplayInit[INIT_LENGTH] = {
 
   0xA4,             //RAM Content mode
 
-  0xAF  // Display on
+  //Display stays off until the first frame is complete, see displayOn()
 };
 
 void displayData(uint8_t data) {
-    startMiniTinyI2C(LCD_I2C_ADDR, false);
-    writeMiniTinyI2C(LCD_DATA);
-    writeMiniTinyI2C(data);
-    stopMiniTinyI2C();    
+    beginMiniTinyI2C(LCD_I2C_ADDR);
+    queueMiniTinyI2C(LCD_DATA);
+    queueMiniTinyI2C(data);
+    commitMiniTinyI2C();    
 }
 
 void initDisplay() {
     //Command Init
-    startMiniTinyI2C(LCD_I2C_ADDR, false);
-    writeMiniTinyI2C(LCD_COMMAND);
-    for (uint8_t i = 0; i < INIT_LENGTH; i++) {
-        writeMiniTinyI2C(DisplayInit[i]);
-    }
-    stopMiniTinyI2C();
-
-    //Data 0 - Clear display
-    startMiniTinyI2C(LCD_I2C_ADDR, false);
-    writeMiniTinyI2C(LCD_DATA);
-    for (uint16_t i = 0; i <= 255; i++) {
-        writeMiniTinyI2C(0x00);
-        writeMiniTinyI2C(0x00);
-        writeMiniTinyI2C(0x00);
-        writeMiniTinyI2C(0x00);
-    }
+    beginMiniTinyI2C(LCD_I2C_ADDR);
+    queueMiniTinyI2C(LCD_COMMAND);
+    queueBufferMiniTinyI2C(DisplayInit, INIT_LENGTH);
+    commitMiniTinyI2C();
+}
 
-    stopMiniTinyI2C();    
+void displayCommand(uint8_t command) {
+    beginMiniTinyI2C(LCD_I2C_ADDR);
+    queueMiniTinyI2C(LCD_COMMAND);
+    queueMiniTinyI2C(command);
+    commitMiniTinyI2C();
 }
 
-//Set Page and Column Display update constraints
-void setDisplayArea(uint8_t startPage, uint8_t endPage, uint8_t startColumn, uint8_t endColumn) {
-    startMiniTinyI2C(LCD_I2C_ADDR, false);
-    writeMiniTinyI2C(LCD_COMMAND);
-    writeMiniTinyI2C(LCD_COMMAND_PAGE_ADDR);
-    writeMiniTinyI2C(startPage);
-    writeMiniTinyI2C(endPage);
-    writeMiniTinyI2C(LCD_COMMAND_COLUMN_ADDR);
-    writeMiniTinyI2C(startColumn);
-    writeMiniTinyI2C(endColumn);
-    stopMiniTinyI2C();
+void displayOn() {
+    displayCommand(LCD_COMMAND_DISPLAY_ON);
+}
+
+//Panel off (the SSD1306 keeps its RAM), then the bus
+void displaySleep() {
+    displayCommand(LCD_COMMAND_DISPLAY_OFF);
+    sleepMiniTinyI2C();
+}
+
+void displayWake() {
+    wakeMiniTinyI2C();
+    displayOn();
+}
+
+void queueCommand(uint8_t command) {
+    queueMiniTinyI2C(LCD_COMMAND_CONTINUE);
+    queueMiniTinyI2C(command);
+}
 
+//Set Page and Column Display update constraints inside an open transaction
+void setDisplayArea(uint8_t startPage, uint8_t endPage, uint8_t startColumn, uint8_t endColumn) {
+    queueCommand(LCD_COMMAND_PAGE_ADDR);
+    queueCommand(startPage);
+    queueCommand(endPage);
+    queueCommand(LCD_COMMAND_COLUMN_ADDR);
+    queueCommand(startColumn);
+    queueCommand(endColumn);
 }
 
 // Game Data and defines
 #define BOARD_LEFT_BORDER 0x0E 
 #define BOARD_RIGHT_BORDER 0xE0
+#define BOARD_BASELINE_LEFT 0xFE
+#define BOARD_BASELINE 0xFF
 #define BOARD_ROWS 96
 #define BOARD_START_ROW 0
 #define BOARD_END_ROW (BOARD_START_ROW + BOARD_ROWS)
@@ -98,6 +111,9 @@ void setDisplayArea(uint8_t startPage, uint8_t endPage, uint8_t startColumn, uin
 #define BOARD_TILE_START_Y 1
 #define BOARD_TILE_START_ROT 0
 #define NUM_TILES 7
+#define BOARD_WIDTH 10
+#define BOARD_HEIGHT 24
+#define BOARD_ROW_FULL 0x03FF
 
 #define SCORE_POS_MARGIN 6
 #define SCORE_ROW_START (BOARD_END_ROW + BOARD_BASELINE_THICKNESS + SCORE_POS_MARGIN)
@@ -125,24 +141,58 @@ void setDisplayArea(uint8_t startPage, uint8_t endPage, uint8_t startColumn, uin
 #define LINES_ROW_START 58
 #define LINES_ROW_END (LINES_ROW_START + 4)
 
-#define SCORE_ATTACHED 0xA
-#define SCORE_LINE_BASE 0x64
-#define SCORE_LINE_BONUS 0x32
+//Scores, lines and level are packed BCD, most significant digit pair first
+#define SCORE_DIGITS 4              //Digit pairs
+#define LINES_DIGITS 2
+#define SCORE_ATTACHED 0x0010
+
+//High score persistence - rotating EEPROM slots of { 4 BCD digit pairs, check }.
+//Scores only ever go up, so the best valid slot is the newest one.
+#define HISCORE_SLOTS 8
+#define HISCORE_SLOT_SIZE 8
+#define HISCORE_CHECK_SEED 0xA5
+#define HISCORE_NONE 0x80           //gHighScoreSlot flag: no valid slot, the high score is 0
+
+#define GRAVITY_LEVELS 20
+
+//Locked cells, one bitmask per board row (bit x = column x, row 0 at the top).
+//The falling tile is not part of it, it is overlaid when drawing. A row has 10
+//bits: the low 8 are in gBoardLow, the top 2 of four rows share a gBoardHigh
+//byte - 30 bytes instead of 48 for uint16_t rows.
+uint8_t gBoardLow[BOARD_HEIGHT];
+uint8_t gBoardHigh[BOARD_HEIGHT / 4];
+
+uint16_t boardRow(uint8_t y) {
+    uint8_t high = gBoardHigh[y >> 2] >> ((y & 0x03) << 1);
+    return ((uint16_t)(high & 0x03) << 8) | gBoardLow[y];
+}
 
-uint8_t gGameBoard[3][10] = {
-    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
-};
+void setBoardRow(uint8_t y, uint16_t cells) {
+    uint8_t shift = (y & 0x03) << 1;
+    gBoardLow[y] = cells;
+    gBoardHigh[y >> 2] = (gBoardHigh[y >> 2] & ~(0x03 << shift)) | ((cells >> 8) << shift);
+}
+
+#ifdef GHOST_PIECE
+int8_t gGhostY = BOARD_TILE_START_Y;    //Where the tile would land, drawn dotted
+#endif
 
 int8_t gPos[2] = { BOARD_TILE_START_X, BOARD_TILE_START_Y };
 uint8_t gRot = BOARD_TILE_START_ROT;
 uint8_t gCurTile = 0;
 uint8_t gNextTile = 0;
-uint32_t gScore = 0x00000000;
-uint32_t gHighScore = 0x12345678;
+uint16_t gRandom = HAL_SCRIPT_SEED;  //xorshift16 state, never 0
+uint8_t gBag = 0;                   //Tiles left in the current 7-bag, bit n = tiles[n]
+uint8_t gScore[SCORE_DIGITS + 1] = { 0x00, 0x00, 0x00, 0x00 };   //Plus the check byte, gScore is the EEPROM slot image
+uint8_t gHighScoreSlot = HISCORE_NONE | (HISCORE_SLOTS - 1);  //Slot holding the high score, the next write goes to the one after
 uint8_t gLevel = 0x01;
-uint16_t gLines = 0x0000;
+uint8_t gGravityCounter = 0;        //Frames until the tile drops one row
+uint8_t gLines[LINES_DIGITS] = { 0x00, 0x00 };
+
+//Board cells touched since the last drawTileRows(): bit y = board row y, and the
+//columns as {min, max}
+uint32_t gDirtyRows = 0;
+uint8_t gDirtyX[2] = { 0xFF, 0x00 };
 
 #define BUTTON_ADC_MARGIN    0x05
 #define BUTTON_LEFT_VALUE_L  (0xD5 - BUTTON_ADC_MARGIN) 
@@ -155,9 +205,50 @@ uint16_t gLines = 0x0000;
 #define BUTTON_ROT_CCW_H     (0x7F + BUTTON_ADC_MARGIN)
 #define BUTTON_ROT_CW_L      (0xD5 - BUTTON_ADC_MARGIN)
 #define BUTTON_ROT_CW_H      (0xD5 + BUTTON_ADC_MARGIN)
-#define ADC_DIRECTIONAL_PIN ADC_MUXPOS_AIN6_gc 
-#define ADC_ROTATIONAL_PIN  ADC_MUXPOS_AIN7_gc 
-uint8_t gCurrentADCPin = ADC_DIRECTIONAL_PIN;
+
+//Classified buttons, one set per ADC pin - key events are (pin << 2) | key
+#define KEY_NONE    0
+#define KEY_LEFT    1
+#define KEY_RIGHT   2
+#define KEY_DOWN    3
+#define KEY_ROT_CCW 1
+#define KEY_ROT_CW  2
+#define KEY_PINS    2
+
+#define KEY_QUEUE_SIZE 4            //Power of two
+#define KEY_DEBOUNCE_FRAMES 2       //Frames a new key state has to hold before it counts
+#define KEY_DAS_FRAMES 10           //Frames before a held move key starts repeating
+#define KEY_ARR_FRAMES 3            //Frames between repeats
+#define KEY_DROP_TAP_FRAMES 15      //A second Down press within this many frames hard drops, fits KEY_TAP_bm
+#define IDLE_SLEEP_FRAMES (HAL_FRAME_HZ * 30)   //No key for this long pauses the game, display off
+#define IDLE_STEP_FRAMES 8                      //Idle time is kept in steps of this many frames
+#define IDLE_SLEEP_STEPS (IDLE_SLEEP_FRAMES / IDLE_STEP_FRAMES)
+
+//Single producer (key scan in the tick ISR) / single consumer (main loop) key event queue
+volatile uint8_t gKeyQueue[KEY_QUEUE_SIZE];
+volatile uint8_t gKeyQueueHead = 0;     //Written by the ISR
+volatile uint8_t gKeyQueueTail = 0;     //Written by the main loop
+uint8_t gKeySampled[KEY_PINS];          //Last state the ISR queued, ISR only
+
+//Per pin key state: latest queued key, debounced key and the debounce, then
+//DAS/ARR frame counter
+#define KEY_RAW_bm      0x03
+#define KEY_STABLE_bm   0x0C
+#define KEY_STABLE_bp   2
+#define KEY_TIMER_bp    4
+uint8_t gKeyState[KEY_PINS];
+
+//Frame counters that fit in a few bits share a byte
+#define KEY_TAP_bm      0x0F            //Frames left for a Down double tap
+#define KEY_IDLE_bm     0xE0            //Frames into the current idle step, carries out of the byte
+#define KEY_IDLE_FRAME  (0x100 / IDLE_STEP_FRAMES)
+uint8_t gKeyFrames = 0;
+uint8_t gIdleSteps = 0;                 //Idle steps since the last key, IDLE_SLEEP_STEPS = asleep
+
+void resetIdle() {
+    gIdleSteps = 0;
+    gKeyFrames &= ~KEY_IDLE_bm;
+}
 
 const uint8_t tileMap[4] = {
     0b00000000,
@@ -166,37 +257,90 @@ const uint8_t tileMap[4] = {
     0b11100000
 };
 
-const uint8_t tiles[NUM_TILES] = {
-    /* X X O O
-       X X O O */
-    0b11001100,
-
-    /* X X X X
-       O O O O */
-    0b11110000,
-
-    /* O X X O
-       X X O O */
-    0b01101100,
-
-    /* X X O O
-       O X X O */
-    0b11000110,
+#ifdef GHOST_PIECE
+//Ghost cells only get their corner dots
+const uint8_t ghostMap[4] = {
+    0b00000000,
+    0b10100000,
+    0b00000000,
+    0b10100000
+};
+#endif
+
+/* X X O O
+   X X O O */
+#define TILE_O 0b11001100
+
+/* X X X X
+   O O O O */
+#define TILE_I 0b11110000
+
+/* O X X O
+   X X O O */
+#define TILE_S 0b01101100
+
+/* X X O O
+   O X X O */
+#define TILE_Z 0b11000110
+
+/* O O X O
+   X X X O */
+#define TILE_L 0b00101110
+
+/* X O O O
+   X X X O */
+#define TILE_J 0b10001110
+
+/* O X O O
+   X X X O */
+#define TILE_T 0b01001110
+
+const uint8_t tiles[NUM_TILES] = { TILE_O, TILE_I, TILE_S, TILE_Z, TILE_L, TILE_J, TILE_T };
+
+//Tile bit b sits at (x, y) = (2 - (b & 3), 1 - (b >> 2)) relative to gPos, each
+//rotation turns that clockwise around (0.5, 0.5)
+#define TILE_X0(b) (2 - ((b) & 3))
+#define TILE_Y0(b) (1 - ((b) >> 2))
+#define TILE_X(b, r) ((r) == 0 ? TILE_X0(b) : (r) == 1 ? 1 - TILE_Y0(b) : (r) == 2 ? 1 - TILE_X0(b) : TILE_Y0(b))
+#define TILE_Y(b, r) ((r) == 0 ? TILE_Y0(b) : (r) == 1 ? TILE_X0(b) : (r) == 2 ? 1 - TILE_Y0(b) : 1 - TILE_X0(b))
+
+//Mask nibble n holds board row gPos[1] - 1 + n, nibble bit i board column gPos[0] - 1 + i
+#define TILE_CELL(t, b, r) ((uint16_t)(((t) >> (b)) & 1) << ((TILE_Y(b, r) + 1) * 4 + TILE_X(b, r) + 1))
+#define TILE_MASK(t, r) (TILE_CELL(t, 0, r) | TILE_CELL(t, 1, r) | TILE_CELL(t, 2, r) | TILE_CELL(t, 3, r) | \
+                         TILE_CELL(t, 4, r) | TILE_CELL(t, 5, r) | TILE_CELL(t, 6, r) | TILE_CELL(t, 7, r))
+
+#define TILE_OFF_BOARD 0x8000
+#define NUM_KICKS 5
+
+//Precomputed tile x rotation masks - O does not rotate, I/S/Z only have two states
+const uint16_t tileMasks[NUM_TILES][4] = {
+    { TILE_MASK(TILE_O, 0), TILE_MASK(TILE_O, 0), TILE_MASK(TILE_O, 0), TILE_MASK(TILE_O, 0) },
+    { TILE_MASK(TILE_I, 0), TILE_MASK(TILE_I, 1), TILE_MASK(TILE_I, 1), TILE_MASK(TILE_I, 1) },
+    { TILE_MASK(TILE_S, 0), TILE_MASK(TILE_S, 1), TILE_MASK(TILE_S, 1), TILE_MASK(TILE_S, 1) },
+    { TILE_MASK(TILE_Z, 0), TILE_MASK(TILE_Z, 1), TILE_MASK(TILE_Z, 1), TILE_MASK(TILE_Z, 1) },
+    { TILE_MASK(TILE_L, 0), TILE_MASK(TILE_L, 1), TILE_MASK(TILE_L, 2), TILE_MASK(TILE_L, 3) },
+    { TILE_MASK(TILE_J, 0), TILE_MASK(TILE_J, 1), TILE_MASK(TILE_J, 2), TILE_MASK(TILE_J, 3) },
+    { TILE_MASK(TILE_T, 0), TILE_MASK(TILE_T, 1), TILE_MASK(TILE_T, 2), TILE_MASK(TILE_T, 3) },
+};
 
-    /* O O X O
-       X X X O */
-    0b00101110,
+//Distinct rotation states per tile (power of two, rotations wrap with a mask)
+const uint8_t tileRotations[NUM_TILES] = { 1, 2, 2, 2, 4, 4, 4 };
 
-    /* X O O O
-       X X X O */
-    0b10001110,
+//Wall kicks tried in order when a rotation collides - x only, +-2 for the I tile.
+//No upward kick: a tile never rises, so it cannot stall above the stack.
+const int8_t kickOffsets[NUM_KICKS] = { 0, -1, 1, 2, -2 };
 
-    /* O X O O
-       X X X O */
-    0b01001110,
+//Frames per row drop for each level at HAL_FRAME_HZ, the last entry holds for higher levels
+const uint8_t gravityFrames[GRAVITY_LEVELS] = {
+    48, 43, 38, 33, 28, 23, 18, 13, 8, 6, 5, 5, 5, 4, 4, 4, 3, 3, 3, 2
 };
 
-const uint8_t numbers[16][3] = {
+//BCD points for clearing 0 - 4 lines at once: 100 + 50 per line
+const uint16_t lineScores[5] = { 0x0000, 0x0150, 0x0200, 0x0250, 0x0300 };
+
+//Digit glyphs, one 4 bit row per byte in display column order - a digit pair is
+//streamed as left | right << 4 without any unpacking (50 bytes for 0 - 9)
+const uint8_t numbers[10][5] = {
     /* 0
         0111
         0101
@@ -205,7 +349,7 @@ const uint8_t numbers[16][3] = {
         0111
         0000
     */
-    { 0b01110101, 0b01010101, 0b01110000 },
+    { 0b0111, 0b0101, 0b0101, 0b0101, 0b0111 },
     /* 1
         0010
         0011
@@ -214,7 +358,7 @@ const uint8_t numbers[16][3] = {
         0111
         0000
     */
-    { 0b00100011, 0b00100010, 0b01110000 },
+    { 0b0010, 0b0011, 0b0010, 0b0010, 0b0111 },
     /* 2
         0111
         0100
@@ -223,7 +367,7 @@ const uint8_t numbers[16][3] = {
         0111
         0000
     */
-    { 0b01110100, 0b00100001, 0b01110000 },
+    { 0b0111, 0b0100, 0b0010, 0b0001, 0b0111 },
     /* 3
         0111
         0100
@@ -232,7 +376,7 @@ const uint8_t numbers[16][3] = {
         0111
         0000
     */
-    { 0b01110100, 0b01100100, 0b01110000 },
+    { 0b0111, 0b0100, 0b0110, 0b0100, 0b0111 },
     /* 4
         0101
         0101
@@ -241,7 +385,7 @@ const uint8_t numbers[16][3] = {
         0100
         0000
     */
-    { 0b01010101, 0b01110100, 0b01000000 },
+    { 0b0101, 0b0101, 0b0111, 0b0100, 0b0100 },
     /* 5
         0111
         0001
@@ -250,7 +394,7 @@ const uint8_t numbers[16][3] = {
         0111
         0000
     */
-    { 0b01110001, 0b01110100, 0b01110000 },
+    { 0b0111, 0b0001, 0b0111, 0b0100, 0b0111 },
     /* 6
         0111
         0001
@@ -259,7 +403,7 @@ const uint8_t numbers[16][3] = {
         0111
         0000
     */
-    { 0b01110001, 0b01110101, 0b01110000 },
+    { 0b0111, 0b0001, 0b0111, 0b0101, 0b0111 },
     /* 7
         0111
         0100
@@ -268,7 +412,7 @@ const uint8_t numbers[16][3] = {
         0010
         0000
     */
-    { 0b01110100, 0b00100010, 0b00100000 },
+    { 0b0111, 0b0100, 0b0010, 0b0010, 0b0010 },
     /* 8
         0111
         0101
@@ -277,7 +421,7 @@ const uint8_t numbers[16][3] = {
         0111
         0000
     */
-    { 0b01110101, 0b01110101, 0b01110000 },
+    { 0b0111, 0b0101, 0b0111, 0b0101, 0b0111 },
     /* 9
         0111
         0101
@@ -286,435 +430,701 @@ const uint8_t numbers[16][3] = {
         0111
         0000
     */
-    { 0b01110101, 0b01110100, 0b01110000 },
-    /* A
-        0111
-        0101
-        0111
-        0101
-        0101
-        0000
-    */
-    { 0b01110101, 0b01110101, 0b01010000 },
-    /* B
-        0111
-        0101
-        0011
-        0101
-        0111
-        0000
-    */
-    { 0b01110101, 0b00110101, 0b01110000 },
-    /* C
-        0111
-        0001
-        0001
-        0001
-        0111
-        0000
-    */
-    { 0b01110001, 0b00010001, 0b01110000 },
-    /* D
-        0011
-        0101
-        0101
-        0101
-        0011
-        0000
-    */
-    { 0b00110101, 0b01010101, 0b00110000 },
-    /* E
-        0111
-        0001
-        0011
-        0001
-        0111
-        0000
-    */
-    { 0b01110001, 0b00110001, 0b01110000 },
-    /* F
-        0111
-        0001
-        0011
-        0001
-        0001
-        0000
-    */
-    { 0b01110001, 0b00110001, 0b00010000 },
+    { 0b0111, 0b0101, 0b0111, 0b0100, 0b0111 },
 };
 
+//Window setup and pixel data go out in a single transaction
 void startDrawing(uint8_t startPage, uint8_t endPage, uint8_t startRow, uint8_t endRow) {
+    beginMiniTinyI2C(LCD_I2C_ADDR);
     setDisplayArea(startPage, endPage, startRow, endRow);
-    startMiniTinyI2C(LCD_I2C_ADDR, false);
-    writeMiniTinyI2C(LCD_DATA);
+    queueMiniTinyI2C(LCD_DATA);
 }
 
-bool boardIndices(uint8_t * x, uint8_t * y, uint8_t page, uint8_t row, bool left) {
-    if (page == BOARD_START_PAGE && left) return false;
-    if (page == BOARD_END_PAGE && !left) return false;
+//Move a 4 bit tile mask row (bit 0 = column posX - 1) onto the board columns
+uint16_t tileRowMask(uint8_t nibble, int8_t posX) {
+    if (posX < 1) {
+        if (posX < -2 || (nibble & ((1 << (1 - posX)) - 1)))
+            return TILE_OFF_BOARD;
+        return nibble >> (1 - posX);
+    }
+    if (posX > BOARD_WIDTH)
+        return TILE_OFF_BOARD;
 
-    *x = (page * 2) - left;
-    *y = (row - BOARD_START_ROW) >> 2;
+    uint16_t row = (uint16_t)nibble << (posX - 1);
+    return (row & ~BOARD_ROW_FULL) ? TILE_OFF_BOARD : row;
+}
 
-    return true;
+//Falling tile cells in board row y, with the tile at row posY
+uint16_t tileRowAt(uint8_t y, int8_t posY) {
+    uint8_t n = y - posY + 1;
+    if (n > 3) return 0x0000;
+    return tileRowMask((tileMasks[gCurTile][gRot] >> (n << 2)) & 0x0F, gPos[0]);
 }
 
-bool populatedCell(uint8_t x, uint8_t y) {
-    uint8_t yy = y >> 3;
-    return (gGameBoard[yy][x] & (1 << (y & 0x7)));
+uint16_t tileRow(uint8_t y) {
+    return tileRowAt(y, gPos[1]);
 }
 
-void populateCell(uint8_t x, uint8_t y, bool set) {
-    uint8_t yy = y >> 3;
-    if (set)
-        gGameBoard[yy][x] |= (1 << (y & 0x7));
-    else 
-        gGameBoard[yy][x] &= ~(1 << (y & 0x7));
+void clearDirty() {
+    gDirtyRows = 0;
+    gDirtyX[0] = 0xFF;
+    gDirtyX[1] = 0x00;
 }
 
-void drawBoard(uint8_t start, uint8_t end) {
-    uint8_t out = 0;
-    startDrawing(BOARD_START_PAGE, BOARD_END_PAGE, start, end);
-    for (uint8_t page = BOARD_START_PAGE; page <= BOARD_END_PAGE; page++) {
-        for (uint8_t row = start; row <= end; row++) {
-            out = 0x00;
-            if (row <= BOARD_END_ROW) {
-                if (page == BOARD_START_PAGE) { //Or in Left border
-                    out |= BOARD_LEFT_BORDER;
-                } else if (page == BOARD_END_PAGE) { //Right border
-                    out |= BOARD_RIGHT_BORDER;
-                }
-                if (row >= BOARD_START_ROW) { //actual gamefield
-                    uint8_t x = 0;
-                    uint8_t y = 0;
-                    if (boardIndices(&x, &y, page, row, true) && populatedCell(x, y)) { //Draw stuff (left part of page)
-                        //Check current sub-row
-                        out |= tileMap[(row - BOARD_START_ROW) & 0x03] >> 4;
-                    }
-                    if (boardIndices(&x, &y, page, row, false) && populatedCell(x, y)) { //Draw stuff (right part of page)
-                        //Check current sub-row
-                        out |= (tileMap[(row - BOARD_START_ROW) & 0x03]);
-                    }
-                }
-            } else {
-                out = (page == 0)? 0xFE : 0xFF;
+void markDirtyColumn(uint8_t x) {
+    if (x < gDirtyX[0]) gDirtyX[0] = x;
+    if (x > gDirtyX[1]) gDirtyX[1] = x;
+}
+
+//Vertical addressing walks a window a display row at a time, top page to
+//bottom page. A display row is one sub-row of a single board row, so its cells
+//(bit x = board column x) are peeled two columns per page. Ghost cells are only
+//drawn where there is no cell.
+void queueBoardRow(uint8_t startPage, uint8_t endPage, uint8_t row, uint16_t cells) {
+    uint8_t segment = tileMap[(row - BOARD_START_ROW) & 0x03];
+    uint8_t shift = (startPage - BOARD_START_PAGE) << 1;
+    cells = (cells << 1) >> shift;                              //Bit 0 / 1 = left / right cell of startPage
+#ifdef GHOST_PIECE
+    uint8_t ghostSegment = ghostMap[(row - BOARD_START_ROW) & 0x03];
+    uint16_t ghost = 0x0000;
+    if (row < BOARD_END_ROW) ghost = tileRowAt((row - BOARD_START_ROW) >> 2, gGhostY);
+    ghost = (ghost << 1) >> shift;
+#endif
+
+    for (uint8_t page = startPage; page <= endPage; page++, cells >>= 2) {
+        uint8_t out = 0x00;
+        if (row <= BOARD_END_ROW) {
+            if (page == BOARD_START_PAGE) { //Or in Left border
+                out |= BOARD_LEFT_BORDER;
+            } else if (page == BOARD_END_PAGE) { //Right border
+                out |= BOARD_RIGHT_BORDER;
             }
-            writeMiniTinyI2C(out);
+            if (cells & 0x01) out |= segment >> 4;              //Left part of page
+            if (cells & 0x02) out |= segment;                   //Right part of page
+#ifdef GHOST_PIECE
+            if (ghost & ~cells & 0x01) out |= ghostSegment >> 4;
+            if (ghost & ~cells & 0x02) out |= ghostSegment;
+            ghost >>= 2;
+#endif
+        } else {
+            out = (page == BOARD_START_PAGE)? BOARD_BASELINE_LEFT : BOARD_BASELINE;
         }
-    } 
-    stopMiniTinyI2C();    
+        queueMiniTinyI2C(out);
+    }
 }
 
+//Board and falling tile cells of the board row under a display row. The
+//callers hand them straight to queueBoardRow(), one call less deep on the stack.
+uint16_t boardCells(uint8_t row) {
+    if (row >= BOARD_END_ROW) return 0x0000;
+    uint8_t y = (row - BOARD_START_ROW) >> 2;
+    return boardRow(y) | tileRow(y);
+}
+
+void drawBoard(uint8_t startPage, uint8_t endPage, uint8_t start, uint8_t end) {
+    BENCH_BEGIN(BENCH_DRAW_BOARD);
+    startDrawing(startPage, endPage, start, end);
+    for (uint8_t row = start; row <= end; row++) {
+        queueBoardRow(startPage, endPage, row, boardCells(row));
+    }
+    commitMiniTinyI2C();
+    BENCH_END(BENCH_DRAW_BOARD);
+}
+
+//Only push the rows that changed since the last call: every run of adjacent
+//dirty board rows is one vertical window, so a tile and its landing spot (or
+//its ghost) far below do not drag the rows between them along
 void drawTileRows() {
-    int8_t startRow = BOARD_START_ROW + (gPos[1] << 2) - (2 * BOARD_TILE_HEIGHT);
-    int8_t endRow = BOARD_START_ROW + (gPos[1] << 2) + (3 * BOARD_TILE_HEIGHT);
-    drawBoard(startRow < 0 ? 0 : startRow, endRow > BOARD_END_ROW ? BOARD_END_ROW : endRow);
-}
-
-void drawFullBoard() {
-    drawBoard(0, BOARD_END_ROW + BOARD_BASELINE_THICKNESS);
-}
-
-bool addOrRemoveTile(bool add, bool check, int8_t *pos) {
-    const uint8_t *t = &tiles[gCurTile];
-
-    int8_t posX = 0;
-    int8_t posY = 0;
-    for (uint8_t bit = 0; bit < 8; bit++) {
-        if ((*t >> bit) & 1) {
-
-            if (gRot == 0 || gCurTile == 0) {
-                posX = pos[0] + (3-(bit & 0x03)) - 1;
-                posY = pos[1] + (1-(bit >> 2));
-            } else if (gRot == 1 || gCurTile < 4) {
-                posX = pos[0] + (bit >> 2);
-                posY = pos[1] + (3-(bit & 0x03)) - 1;
-            } else if (gRot == 2) {
-                posX = pos[0] + (bit & 0x03) - 1;
-                posY = pos[1] + (bit >> 2);
-            } else {
-                posX = pos[0] + (1-(bit >> 2));
-                posY = pos[1] + (bit & 0x03) - 1;
-            }
-            
-            if ((add && populatedCell(posX, posY)) || posY >= 24 || posX < 0 || posX > 9) {
-                return false; //Bail!
-            }
-            if (!check)
-                populateCell(posX, posY, add);
+    if (!gDirtyRows) return; //Nothing moved
+    BENCH_BEGIN(BENCH_DRAW_TILE_ROWS);
+
+    //Board column x lives in page (x + 1) / 2, board row y in display rows y*4 to y*4+3.
+    //All runs share the page span of the dirty columns.
+    uint8_t startPage = BOARD_START_PAGE + ((gDirtyX[0] + 1) >> 1);
+    uint8_t endPage = BOARD_START_PAGE + ((gDirtyX[1] + 1) >> 1);
+    //gDirtyRows is used up in place, a 32 bit copy would live across the calls
+    for (uint8_t y = 0; gDirtyRows; y++, gDirtyRows >>= 1) {
+        if (!(gDirtyRows & 1)) continue;
+        uint8_t top = y;
+        do {
+            y++;
+        } while ((gDirtyRows >>= 1) & 1);
+        drawBoard(startPage, endPage, BOARD_START_ROW + (top << 2), BOARD_START_ROW + (y << 2) - 1);
+    }
+    clearDirty();
+    BENCH_END(BENCH_DRAW_TILE_ROWS);
+}
+
+//Shift-and-mask collision test, the board is never touched
+bool tileFits(uint8_t tile, uint8_t rot, int8_t posX, int8_t posY) {
+    BENCH_BEGIN(BENCH_TILE_FITS);
+    uint16_t mask = tileMasks[tile][rot];
+    for (int8_t y = posY - 1; mask; mask >>= 4, y++) {
+        uint8_t nibble = mask & 0x0F;
+        if (!nibble) continue;
+
+        uint16_t row = tileRowMask(nibble, posX);
+        if ((row & TILE_OFF_BOARD) || y < 0 || y >= BOARD_HEIGHT || (boardRow(y) & row)) {
+            BENCH_END(BENCH_TILE_FITS);
+            return false; //Bail!
         }
     }
 
+    BENCH_END(BENCH_TILE_FITS);
     return true;
 }
 
-bool updateTilePos(int8_t x, int8_t y) {
-    int8_t pos[2] = {gPos[0] + x, gPos[1] + y};
+void lockTile() {
+    uint16_t mask = tileMasks[gCurTile][gRot];
+    for (uint8_t y = gPos[1] - 1; mask; mask >>= 4, y++) {
+        if (!(mask & 0x0F)) continue;
+        setBoardRow(y, boardRow(y) | tileRowMask(mask & 0x0F, gPos[0]));
+    }
+}
+
+//Rows the tile can fall before it lands
+uint8_t dropDistance() {
+    uint8_t drop = 0;
+    while (tileFits(gCurTile, gRot, gPos[0], gPos[1] + drop + 1)) {
+        drop++;
+    }
+    return drop;
+}
+
+//Cells of the current tile with its rows starting at posY
+void markFootprintDirty(int8_t posY) {
+    uint16_t mask = tileMasks[gCurTile][gRot];
+    uint32_t row = (uint32_t)1 << (posY - 1);                  //Tiles never reach above row 0
+    for (; mask; mask >>= 4, row <<= 1) {
+        if (!(mask & 0x0F)) continue;
+        gDirtyRows |= row;
+        for (uint8_t bit = 0; bit < 4; bit++) {
+            if ((mask >> bit) & 1)
+                markDirtyColumn(gPos[0] - 1 + bit);
+        }
+    }
+}
 
-    //Remove old tile
-    addOrRemoveTile(false, false, gPos);
+void markTileDirty() {
+    markFootprintDirty(gPos[1]);
+#ifdef GHOST_PIECE
+    gGhostY = gPos[1] + dropDistance();
+    markFootprintDirty(gGhostY);
+#endif
+}
 
-    //Check if new pos is clear
-    if (!addOrRemoveTile(true, true, pos)) {
-        addOrRemoveTile(true, false, gPos);
+bool updateTilePos(int8_t x, int8_t y) {
+    BENCH_BEGIN(BENCH_UPDATE_TILE_POS);
+    if (!tileFits(gCurTile, gRot, gPos[0] + x, gPos[1] + y)) {
+        BENCH_END(BENCH_UPDATE_TILE_POS);
         return false;
     }
-    
-    //Update position
-    gPos[0] = pos[0];
-    gPos[1] = pos[1];
 
-    //add new tile position
-    addOrRemoveTile(true, false, gPos);
+    //Old and new footprint both need a redraw
+    markTileDirty();
+    gPos[0] += x;
+    gPos[1] += y;
+    markTileDirty();
 
+    BENCH_END(BENCH_UPDATE_TILE_POS);
     return true;
 }
 
-void plantASeed() {
-    gNextTile = 4; //Find something better!
+//Instant drop, the tile locks on the gravity step of this same frame
+void hardDrop() {
+    updateTilePos(0, dropDistance());
+    gGravityCounter = 1;
 }
 
-void drawNextSegment(bool left, bool right) {
-        uint8_t out = 0x00;
+//dir: 1 = clockwise, -1 = counter clockwise
+bool rotateTile(int8_t dir) {
+    uint8_t rot = (gRot + dir) & (tileRotations[gCurTile] - 1);
+    if (rot == gRot)
+        return false;
 
-        for (uint8_t i = 0; i < 4; i++) {
-            if(left)
-                out |= tileMap[i] >> 4;
-            if(right)
-                out |= tileMap[i];
-            writeMiniTinyI2C(out);
+    for (uint8_t k = 0; k < NUM_KICKS; k++) {
+        int8_t x = gPos[0] + kickOffsets[k];
+        if (tileFits(gCurTile, rot, x, gPos[1])) {
+            markTileDirty();
+            gRot = rot;
+            gPos[0] = x;
+            markTileDirty();
+            return true;
         }
+    }
 
+    return false;
 }
 
-void drawNextTile() {
-    startDrawing(NEXT_TILE_PAGE_START, NEXT_TILE_PAGE_END, NEXT_TILE_ROW_START, NEXT_TILE_ROW_END);
+#define BAG_FULL ((1 << NUM_TILES) - 1)
 
-    writeMiniTinyI2C(0xFF);
-    drawNextSegment(tiles[gNextTile] & 0b10000000, tiles[gNextTile] & 0b01000000);
-    drawNextSegment(tiles[gNextTile] & 0b00001000, tiles[gNextTile] & 0b00000100);
-    writeMiniTinyI2C(0x00);
-    writeMiniTinyI2C(0xFF);
-    writeMiniTinyI2C(0xFF);
-    drawNextSegment(tiles[gNextTile] & 0b00100000, tiles[gNextTile] & 0b00010000);
-    drawNextSegment(tiles[gNextTile] & 0b00000010, tiles[gNextTile] & 0b00000001);
-    writeMiniTinyI2C(0x00);
-    writeMiniTinyI2C(0xFF);
+//xorshift16 (7, 9, 8) - full 2^16 - 1 period, shifts and xors only
+uint16_t nextRandom() {
+    gRandom ^= gRandom << 7;
+    gRandom ^= gRandom >> 9;
+    gRandom ^= gRandom << 8;
+    return gRandom;
+}
 
-    stopMiniTinyI2C();
+//7-bag: every tile once per bag. Random 3 bit picks are rejected until one
+//hits a tile still in the bag.
+uint8_t drawFromBag() {
+    if (!gBag) gBag = BAG_FULL;
+
+    uint8_t tile;
+    do {
+        tile = nextRandom() >> 13;                              //Top bits, xorshift's best
+    } while (!(gBag & (1 << tile)));                            //Bit 7 is never in the bag
+
+    gBag &= ~(1 << tile);
+    return tile;
+}
+
+void plantASeed(uint16_t seed) {
+    gRandom = seed;
+    gNextTile = drawFromBag();
 }
 
-void updateNextTile() {
-    gNextTile = (gNextTile + 3) % 7;
-    drawNextTile(); 
+//Preview column for a pair of tile bits (bit 1 = left cell, bit 0 = right cell)
+const uint8_t nextSegments[4] = { 0x00, 0xE0, 0x0E, 0xEE };
+
+//Preview byte at row r of its window, half 0 / 1 = top / bottom page: a solid
+//row at both ends, and each tile column is a blank row then three lit rows
+uint8_t nextTileByte(uint8_t r, uint8_t half) {
+    if (r == 0 || r == NEXT_TILE_ROW_END - NEXT_TILE_ROW_START)
+        return 0xFF;
+
+    uint8_t cell = r - 1;
+    if (!(cell & 0x03))
+        return 0x00;
+    uint8_t tile = tiles[gNextTile] >> ((cell & 0x04) ? 0 : 4);
+    return nextSegments[(half ? tile : tile >> 2) & 0x03];
 }
 
-void injectNextTile() {
+void drawNextTile() {
+    startDrawing(NEXT_TILE_PAGE_START, NEXT_TILE_PAGE_END, NEXT_TILE_ROW_START, NEXT_TILE_ROW_END);
+    for (uint8_t r = 0; r <= NEXT_TILE_ROW_END - NEXT_TILE_ROW_START; r++) {
+        queueMiniTinyI2C(nextTileByte(r, 0));
+        queueMiniTinyI2C(nextTileByte(r, 1));
+    }
+    commitMiniTinyI2C();
+}
+
+//Moves the preview tile to the spawn point and deals the next preview. False
+//if the new tile does not fit there - the game is over.
+bool spawnTile() {
     gPos[0] = BOARD_TILE_START_X;
     gPos[1] = BOARD_TILE_START_Y;
     gRot = BOARD_TILE_START_ROT;
     gCurTile = gNextTile;
-    updateNextTile();
+    gNextTile = drawFromBag();
+    markTileDirty();
+    return tileFits(gCurTile, gRot, gPos[0], gPos[1]);
 }
 
-void drawNumberSegments(uint8_t val) {
-    uint8_t out = 0x00;
-    uint8_t left = (val & 0xF0) >> 4;
-    uint8_t right = val & 0x0F;
-    out  = (numbers[left][0] & 0xF0) >> 4;
-    out |= (numbers[right][0] & 0xF0);
-    writeMiniTinyI2C(out);
-    out  = (numbers[left][0] & 0x0F);
-    out |= (numbers[right][0] & 0x0F) << 4;
-    writeMiniTinyI2C(out);
-    out  = (numbers[left][1] & 0xF0) >> 4;
-    out |= (numbers[right][1] & 0xF0);
-    writeMiniTinyI2C(out);
-    out  = (numbers[left][1] & 0x0F);
-    out |= (numbers[right][1] & 0x0F) << 4;
-    writeMiniTinyI2C(out);
-    out  = (numbers[left][2] & 0xF0) >> 4;
-    out |= (numbers[right][2] & 0xF0);
-    writeMiniTinyI2C(out);
+bool injectNextTile() {
+    bool fits = spawnTile();
+    drawNextTile();
+    return fits;
 }
 
-void drawScore(uint8_t scoreAdd) {
-    gScore += scoreAdd;
-
-    startDrawing(SCORE_PAGE_START, SCORE_PAGE_END, SCORE_ROW_START, SCORE_ROW_END);
-
-    drawNumberSegments((gScore & 0xFF000000) >> 24);
-    drawNumberSegments((gScore & 0x00FF0000) >> 16);
-    drawNumberSegments((gScore & 0x0000FF00) >> 8);
-    drawNumberSegments((gScore & 0x000000FF));
-
-    stopMiniTinyI2C();     
+//Display row of a digit pair, the two glyphs share a page
+uint8_t digitSegment(uint8_t val, uint8_t row) {
+    return numbers[val >> 4][row] | (numbers[val & 0x0F][row] << 4);
+}
 
-    startDrawing(HISCORE_PAGE_START, HISCORE_PAGE_END, HISCORE_ROW_START, HISCORE_ROW_END);
+//Packed BCD add with carry into num (len digit pairs, most significant first).
+//Returns a bit per digit pair that changed (bit i = num[i]), saturates at all nines.
+uint8_t bcdAdd(uint8_t *num, uint8_t len, uint16_t add) {
+    uint8_t changed = 0;
+    uint8_t carry = 0;
+
+    for (int8_t i = len - 1; i >= 0 && (add || carry); i--) {
+        uint8_t lo = (num[i] & 0x0F) + (add & 0x0F) + carry;
+        uint8_t hi = (num[i] >> 4) + ((add >> 4) & 0x0F);
+        add >>= 8;
+
+        if (lo > 9) { lo -= 10; hi++; }
+        carry = (hi > 9);
+        if (carry) hi -= 10;
+
+        uint8_t val = (hi << 4) | lo;
+        if (val != num[i]) {
+            num[i] = val;
+            changed |= 1 << i;
+        }
+    }
 
-    drawNumberSegments((gHighScore & 0xFF000000) >> 24);
-    drawNumberSegments((gHighScore & 0x00FF0000) >> 16);
-    drawNumberSegments((gHighScore & 0x0000FF00) >> 8);
-    drawNumberSegments((gHighScore & 0x000000FF));
+    if (carry) {
+        for (uint8_t i = 0; i < len; i++) num[i] = 0x99;        //No memset call, bcdAdd stays a leaf
+        changed = (1 << len) - 1;
+    }
+    return changed;
+}
 
-    stopMiniTinyI2C();     
+uint8_t bcdToBin(uint8_t val) {
+    uint8_t tens = val >> 4;
+    return (tens << 3) + (tens << 1) + (val & 0x0F);
 }
 
-void drawLevel() {
-    startDrawing(LEVEL_PAGE_START, LEVEL_PAGE_END, LEVEL_ROW_START, LEVEL_ROW_END);
+//Push only the changed digit pairs of a counter that has one pair per page
+void drawDigitPairs(const uint8_t *num, uint8_t changed, uint8_t page, uint8_t row) {
+    if (!changed) return;
 
-    drawNumberSegments(gLevel);
+    uint8_t first = 0;
+    while (!(changed & (1 << first))) first++;
+    uint8_t last = first;
+    while (changed >> (last + 1)) last++;
 
-    stopMiniTinyI2C();     
+    startDrawing(page + first, page + last, row, row + 4);
+    for (uint8_t r = 0; r < 5; r++) {
+        for (uint8_t i = first; i <= last; i++) {
+            queueMiniTinyI2C(digitSegment(num[i], r));
+        }
+    }
+    commitMiniTinyI2C();
 }
 
-void drawLines() {
-    startDrawing(LINES_PAGE_START, LINES_PAGE_END, LINES_ROW_START, LINES_ROW_END);
+//Digit pair i of the high score, read from its EEPROM slot when needed
+uint8_t highScoreDigits(uint8_t i) {
+    if (gHighScoreSlot & HISCORE_NONE) return 0x00;
+    return halEepromRead(gHighScoreSlot * HISCORE_SLOT_SIZE + i);
+}
 
-    drawNumberSegments((gLines & 0xFF00) >> 8);
-    drawNumberSegments((gLines & 0x00FF));
+//True if score (SCORE_DIGITS pairs) is above the high score
+bool beatsHighScore(const uint8_t *score) {
+    for (uint8_t i = 0; i < SCORE_DIGITS; i++) {
+        uint8_t best = highScoreDigits(i);
+        if (score[i] != best) return score[i] > best;
+    }
+    return false;
+}
 
-    stopMiniTinyI2C();     
+//HUD byte at a display row and page: the counters, the preview or blank
+uint8_t hudByte(uint8_t row, uint8_t page) {
+    uint8_t digits;
+    if (page >= SCORE_PAGE_START && page <= SCORE_PAGE_END && row >= SCORE_ROW_START && row <= SCORE_ROW_END) {
+        digits = gScore[page - SCORE_PAGE_START];
+        row -= SCORE_ROW_START;
+    } else if (page >= HISCORE_PAGE_START && page <= HISCORE_PAGE_END && row >= HISCORE_ROW_START && row <= HISCORE_ROW_END) {
+        digits = highScoreDigits(page - HISCORE_PAGE_START);
+        row -= HISCORE_ROW_START;
+    } else if (page == LEVEL_PAGE_START && row >= LEVEL_ROW_START && row <= LEVEL_ROW_END) {
+        digits = gLevel;
+        row -= LEVEL_ROW_START;
+    } else if (page >= LINES_PAGE_START && row >= LINES_ROW_START && row <= LINES_ROW_END) {
+        digits = gLines[page - LINES_PAGE_START];
+        row -= LINES_ROW_START;
+    } else if (page >= NEXT_TILE_PAGE_START && row >= NEXT_TILE_ROW_START && row <= NEXT_TILE_ROW_END) {
+        return nextTileByte(row - NEXT_TILE_ROW_START, page - NEXT_TILE_PAGE_START);
+    } else {
+        return 0x00;
+    }
+    return digitSegment(digits, row);                           //One digit pair lookup for every counter
 }
 
-void wait_ms(uint16_t ms) {
-    _delay_ms(ms);
+void addScore(uint16_t scoreAdd) {
+    BENCH_BEGIN(BENCH_ADD_SCORE);
+    drawDigitPairs(gScore, bcdAdd(gScore, SCORE_DIGITS, scoreAdd), SCORE_PAGE_START, SCORE_ROW_START);
+    BENCH_END(BENCH_ADD_SCORE);
 }
 
-bool checkGameOver() {
-    return (gPos[1] == BOARD_TILE_START_Y);
+void drawLevel() {
+    drawDigitPairs(&gLevel, 0x01, LEVEL_PAGE_START, LEVEL_ROW_START);
 }
 
-void drawEndSequence() {
-    for (uint8_t i = 2; i >= 0; i--) {
-        for (uint8_t j = 8; j > 0; j--) {
-            for (uint8_t column = 0; column < 10; column++) {
-                gGameBoard[i][column] |= (0x1 << (j-1));
-            }
-            drawFullBoard();
+//The whole first frame, playfield and HUD, in one column major stream through
+//the full screen window DisplayInit leaves behind. Every GDDRAM byte is sent
+//once: no clear, no image that the HUD draws then overwrite.
+void drawFirstFrame() {
+    beginMiniTinyI2C(LCD_I2C_ADDR);
+    queueMiniTinyI2C(LCD_DATA);
+    for (uint8_t row = 0; row < LCD_COLUMNS; row++) {
+        uint8_t page = 0;
+        if (row <= BOARD_END_ROW + BOARD_BASELINE_THICKNESS) {
+            queueBoardRow(BOARD_START_PAGE, BOARD_END_PAGE, row, boardCells(row));
+            page = BOARD_END_PAGE + 1;
+        }
+        for (; page < LCD_PAGES; page++) {
+            queueMiniTinyI2C(hudByte(row, page));
         }
     }
+    commitMiniTinyI2C();
 }
 
-void checkCompletedLines() {
-    uint8_t completedLines = 0;
-    //scan board for complete lines
-    for (uint8_t i = 2; i >= 0; i--) {
-        for (uint8_t j = 8; j > 0; j--) {
-            bool completeLine = true;
-            for (uint8_t column = 0; (column < 10) && completeLine; column++) {
-                gGameBoard[i][column] |= (0x1 << (j-1));
-            }
-            if (completeLine) {
-                completedLines++;
-                //Remove the line and shift all above down one
-            }
-        }
+//Game over fill, bottom to top: one board row per frame and only that row is sent
+void drawEndSequence() {
+    for (int8_t y = BOARD_HEIGHT - 1; y >= 0; y--) {
+        halWaitFrame();
+        setBoardRow(y, BOARD_ROW_FULL);
+        uint8_t row = BOARD_START_ROW + (y << 2);
+        drawBoard(BOARD_START_PAGE, BOARD_END_PAGE, row, row + BOARD_TILE_HEIGHT - 1);
     }
-    gLines += completedLines;
-    drawScore(SCORE_LINE_BASE + SCORE_LINE_BONUS*completedLines);
 }
 
-void initKeys() {
-    //Set ADC to VDD reference voltage and prescaler to 16 divisor (20/16 = 1.25MHz)
-    ADC0.CTRLC = ADC_SAMPCAP_bm | ADC_REFSEL_VDDREF_gc | ADC_PRESC_DIV16_gc;
-
-    //Configure ADC on pin 2 (AIN6) - direction and drop
-    //Turn off Digital input buffer
-    PORTA.PIN2CTRL = PORT_ISC_INPUT_DISABLE_gc;
-
-    //Configure ADC on pin 3 (AIN7) - rotations
-    //Turn off Digital input buffer
-    PORTA.PIN3CTRL = PORT_ISC_INPUT_DISABLE_gc;
-
-    //Enable global interrupts
-    CPU_SREG |= 0b10000000;
-
-    //Clear conversion interrupt (Write 1 to clear!)
-    ADC0.INTFLAGS = ADC_RESRDY_bm;
-
-    //Enable conversion interrupt
-    ADC0.INTCTRL = ADC_RESRDY_bm;
-
-    //8bit ADC and enable
-    ADC0.CTRLA = ADC_RESSEL_8BIT_gc | ADC_ENABLE_bm;
-
-    //Default to AIN6 pin
-    ADC0.MUXPOS = gCurrentADCPin;
-
-    //Start ADC loop!
-    ADC0.COMMAND |= ADC_STCONV_bm;
+//Drops the full rows in one pass from the bottom up, the rows above slide
+//down. The redraw is left to drawTileRows(): a clear is rare, so the whole
+//board is marked dirty.
+void clearCompletedLines() {
+    int8_t dst = BOARD_HEIGHT - 1;
+    for (int8_t y = BOARD_HEIGHT - 1; y >= 0; y--) {
+        uint16_t cells = boardRow(y);
+        if (cells != BOARD_ROW_FULL) setBoardRow(dst--, cells);
+    }
+    uint8_t completedLines = dst + 1;
+    if (!completedLines) return;
+    while (dst >= 0) {
+        setBoardRow(dst--, 0x0000);
+    }
+    gDirtyRows = ((uint32_t)1 << BOARD_HEIGHT) - 1;
+    gDirtyX[0] = 0;
+    gDirtyX[1] = BOARD_WIDTH - 1;
+
+    //A level every ten lines: whenever the BCD tens digit moves on
+    uint8_t tens = gLines[LINES_DIGITS - 1] & 0xF0;
+    drawDigitPairs(gLines, bcdAdd(gLines, LINES_DIGITS, completedLines), LINES_PAGE_START, LINES_ROW_START);
+    if ((gLines[LINES_DIGITS - 1] & 0xF0) != tens && bcdAdd(&gLevel, 1, 1))
+        drawLevel();
+    addScore(lineScores[completedLines]);
 }
 
-ISR(ADC0_RESRDY_vect) {
-    //Check if it was direction or rotation pin
-    //Conversion result is in ADC0.RESL
-    uint8_t result = ADC0.RESL;
+//ADC result path - runs in the ISR, so it only classifies and queues changes
+void onKeySample(uint8_t pin, uint8_t result) {
+    uint8_t key = KEY_NONE;
 
-    if (gCurrentADCPin == ADC_DIRECTIONAL_PIN) {
+    if (pin == HAL_KEYS_DIRECTIONAL) {
         //Direction (AIN6):
         //"Left"  (0xD5)
         //"Right" (0x57)
         //"Down"  (0x7F)
         if (result > BUTTON_LEFT_VALUE_L && result < BUTTON_LEFT_VALUE_H) {
-            updateTilePos(-1, 0);
+            key = KEY_LEFT;
         } else if (result > BUTTON_RIGHT_VALUE_L && result < BUTTON_RIGHT_VALUE_H) {
-            updateTilePos(1, 0);
+            key = KEY_RIGHT;
         } else if (result > BUTTON_DOWN_VALUE_L && result < BUTTON_DOWN_VALUE_H) {
-            updateTilePos(0, 1);
+            key = KEY_DOWN;
         }
-        gCurrentADCPin = ADC_ROTATIONAL_PIN;
-    } else { //ADC_ROTATIONAL_PIN
+    } else { //HAL_KEYS_ROTATIONAL
         //Rotation (AIN7):
         //"Rotation Left (CCW)" (0x7F)
         //"Rotation Right (CW)" (0xD5)
+        if (result > BUTTON_ROT_CCW_L && result < BUTTON_ROT_CCW_H) {
+            key = KEY_ROT_CCW;
+        } else if (result > BUTTON_ROT_CW_L && result < BUTTON_ROT_CW_H) {
+            key = KEY_ROT_CW;
+        }
+    }
+
+    if (key == gKeySampled[pin]) return;
+
+    uint8_t head = (gKeyQueueHead + 1) & (KEY_QUEUE_SIZE - 1);
+    if (head == gKeyQueueTail) return; //Full - the next sample retries
+
+    gKeyQueue[gKeyQueueHead] = (pin << 2) | key;
+    gKeyQueueHead = head;
+    gKeySampled[pin] = key;
+}
+
+void doKey(uint8_t pin, uint8_t key) {
+    if (pin == HAL_KEYS_DIRECTIONAL) {
+        if (key == KEY_LEFT) {
+            updateTilePos(-1, 0);
+        } else if (key == KEY_RIGHT) {
+            updateTilePos(1, 0);
+        } else {
+            updateTilePos(0, 1);
+        }
+    } else {
+        rotateTile(key == KEY_ROT_CW ? 1 : -1);
+    }
+}
+
+//Any press counts as activity. True when it only woke the display up.
+bool wakeUp() {
+    bool asleep = (gIdleSteps == IDLE_SLEEP_STEPS);
+    resetIdle();
+    if (asleep) displayWake();
+    return asleep;
+}
+
+//Drain the key queue, then debounce and auto-repeat each pin
+void processKeys() {
+    if (gKeyFrames & KEY_TAP_bm) gKeyFrames--;
+
+    while (gKeyQueueTail != gKeyQueueHead) {
+        uint8_t tail = gKeyQueueTail;
+        uint8_t event = gKeyQueue[tail];
+        gKeyQueueTail = (tail + 1) & (KEY_QUEUE_SIZE - 1);
+
+        uint8_t pin = event >> 2;
+        uint8_t state = gKeyState[pin];
+        if ((event ^ state) & KEY_RAW_bm)
+            gKeyState[pin] = (state & KEY_STABLE_bm) | (event & KEY_RAW_bm);    //Timer restarts
+    }
+
+    for (uint8_t pin = 0; pin < KEY_PINS; pin++) {
+        uint8_t state = gKeyState[pin];
+        uint8_t key = state & KEY_RAW_bm;
+        uint8_t timer = (state >> KEY_TIMER_bp) + 1;
+        state &= KEY_RAW_bm | KEY_STABLE_bm;
+
+        if (key != (state >> KEY_STABLE_bp)) {
+            if (timer < KEY_DEBOUNCE_FRAMES) {
+                gKeyState[pin] = state | (timer << KEY_TIMER_bp);
+                continue;
+            }
+            gKeyState[pin] = key | (key << KEY_STABLE_bp);
+            if (key == KEY_NONE || wakeUp()) continue;
+            if (pin == HAL_KEYS_DIRECTIONAL && key == KEY_DOWN) {
+                if (gKeyFrames & KEY_TAP_bm) {
+                    gKeyFrames &= ~KEY_TAP_bm;
+                    hardDrop();
+                    continue;
+                }
+                gKeyFrames |= KEY_DROP_TAP_FRAMES;
+            }
+            doKey(pin, key);
+        } else if (key != KEY_NONE && pin == HAL_KEYS_DIRECTIONAL) {
+            //Only moves repeat, rotations need a new press
+            if (timer >= KEY_DAS_FRAMES) {
+                timer = KEY_DAS_FRAMES - KEY_ARR_FRAMES;
+                resetIdle();
+                doKey(pin, key);
+            }
+            gKeyState[pin] = state | (timer << KEY_TIMER_bp);
+        }
+    }
+}
 
-        gCurrentADCPin = ADC_DIRECTIONAL_PIN;
+void resetGravity() {
+    uint8_t level = bcdToBin(gLevel);
+    gGravityCounter = gravityFrames[level > GRAVITY_LEVELS ? GRAVITY_LEVELS - 1 : level - 1];
+}
+
+//One frame of game logic, false once the game is over
+bool updateGame() {
+    processKeys();
+
+    //Paused with the display off until a key wakes it up
+    if (gIdleSteps == IDLE_SLEEP_STEPS) return true;
+    gKeyFrames += KEY_IDLE_FRAME;
+    if (!(gKeyFrames & KEY_IDLE_bm) && ++gIdleSteps == IDLE_SLEEP_STEPS) {
+        displaySleep();
+        return true;
     }
 
-    //Clear conversion interrupt (Write 1 to clear!)
-    ADC0.INTFLAGS = ADC_RESRDY_bm;
+    if (--gGravityCounter) return true;
+    resetGravity();
 
-    //Restart conversation again!
-    ADC0.MUXPOS = gCurrentADCPin;
+    if (!updateTilePos(0, 1)) {
+        lockTile();
+        addScore(SCORE_ATTACHED);
+        clearCompletedLines();
+        return injectNextTile();                                //Game over when the next one does not fit
+    }
+    return true;
+}
 
-    //Start ADC loop!
-    ADC0.COMMAND |= ADC_STCONV_bm;
+uint8_t highScoreCheck(const uint8_t *score) {
+    return (score[0] + score[1] + score[2] + score[3]) ^ HISCORE_CHECK_SEED;
+}
+
+//Bounded boot read: 8 slots x 5 bytes of memory mapped EEPROM. The game has not
+//started, so gScore is the read buffer instead of a slot copy on the stack.
+void loadHighScore() {
+    for (uint8_t i = 0; i < HISCORE_SLOTS; i++) {
+        for (uint8_t j = 0; j <= SCORE_DIGITS; j++) {
+            gScore[j] = halEepromRead(i * HISCORE_SLOT_SIZE + j);
+        }
+        if (gScore[SCORE_DIGITS] == highScoreCheck(gScore) && beatsHighScore(gScore))
+            gHighScoreSlot = i;
+    }
+    memset(gScore, 0x00, sizeof(gScore));
 }
 
 void updateHighScore() {
+    if (!beatsHighScore(gScore)) return;
+
+    gScore[SCORE_DIGITS] = highScoreCheck(gScore);
+
+    //Next slot in the ring spreads the wear, the write completes in the background
+    gHighScoreSlot = (gHighScoreSlot + 1) & (HISCORE_SLOTS - 1);
+    halEepromWrite(gHighScoreSlot * HISCORE_SLOT_SIZE, gScore, sizeof(gScore));
 
+    //The new high score is the score itself
+    drawDigitPairs(gScore, (1 << SCORE_DIGITS) - 1, HISCORE_PAGE_START, HISCORE_ROW_START);
 }
 
-int main() {
+#ifdef STACK_MONITOR
+//Debug build: show the untouched stack bytes in the lines counter at game over
+void drawStackReport() {
+    uint8_t unused = halStackUnused();
+    uint8_t bcd[LINES_DIGITS] = { 0x00, 0x00 };
+    while (unused--) bcdAdd(bcd, LINES_DIGITS, 1);
+    drawDigitPairs(bcd, (1 << LINES_DIGITS) - 1, LINES_PAGE_START, LINES_ROW_START);
+}
+#endif
+
+#ifdef POWER_STATS
+//Debug build: show the percentage of the game the CPU was awake in the level
+//counter and that of the busiest frame in the lines counter
+void drawPowerReport() {
+    uint8_t awake = halAwakePercent();
+    uint8_t bcd = 0x00;
+    while (awake--) bcdAdd(&bcd, 1, 1);
+    drawDigitPairs(&bcd, 1, LEVEL_PAGE_START, LEVEL_ROW_START);
+
+    uint8_t peak = halPeakAwakePercent();
+    uint8_t peakBcd[LINES_DIGITS] = { 0x00, 0x00 };
+    while (peak--) bcdAdd(peakBcd, LINES_DIGITS, 1);
+    drawDigitPairs(peakBcd, (1 << LINES_DIGITS) - 1, LINES_PAGE_START, LINES_ROW_START);
+}
+#endif
+
+HAL_MAIN int main() {
+    BENCH_BEGIN(BENCH_BOOT);
     initMiniTinyI2C(1100);
 
     initDisplay();
 
-    initKeys();
-
-    plantASeed();
-    injectNextTile();
-    addOrRemoveTile(true, false, gPos);
-    drawFullBoard();
-//    drawScore(0);
-//    drawLevel();
-//    drawLines();
-    while(1) {
-        wait_ms(10);
-        if (!updateTilePos(0, 1)) {
-            if(checkGameOver()) {
-                break;
-            }
-//            drawScore(SCORE_ATTACHED);
-            //checkCompletedLines();
-            injectNextTile();
+    plantASeed(halRandomSeed());                                //Borrows the ADC before the keys get it
+    halInitKeys();
+    halInitTimer();
+
+    loadHighScore();
+    spawnTile();
+    resetGravity();
+
+    drawFirstFrame();
+    clearDirty();
+    displayOn();
+    BENCH_END(BENCH_BOOT);
+
+    bool running = true;
+    while(running) {
+        //Catch up on every tick that passed, then render once
+        uint8_t frames = halWaitFrame();
+        BENCH_BEGIN(BENCH_FRAME);
+        for (; frames && running; frames--) {
+            running = updateGame();
         }
         drawTileRows();
+        BENCH_END(BENCH_FRAME);
     }
 
     drawEndSequence();
     updateHighScore();
-
-    while(1) {}
+#ifdef STACK_MONITOR
+    drawStackReport();
+#endif
+#ifdef POWER_STATS
+    drawPowerReport();
+#endif
+
+    //Leave the final score up for a while, then switch everything off
+    for (uint16_t i = IDLE_SLEEP_FRAMES; i; i--) {
+        halWaitFrame();
+    }
+    displaySleep();
+    halHalt();
 }
\ No newline at end of file
@@ -0,0 +1,305 @@
+// Cycle benchmark harness for the BENCH firmware image (see include/bench.h).
+//
+// UNVERIFIED SCAFFOLDING: upstream simavr has no attiny202 / avrxmega3 core, so
+// `-m attiny202` does not load and this harness has never produced a report.
+// It needs an out of tree core with the memory map described below first.
+// Until then no cycle figure in this tree comes from it.
+//
+// Runs the real AVR ELF under simavr, timestamps the GPIOR0/GPIOR1 marker
+// writes and reports cycles per call for every marker plus cycles per frame as
+// JSON. TWI0 is modelled as an instant, always-ACKing master so only the CPU
+// cost of the renderer is measured, not the bus.
+//
+// With -c it also writes one CSV row per game frame: cycles of the frame, of
+// drawTileRows and updateTilePos within it, and the TWI traffic it caused.
+//
+// Frames run back to back here, on the device the rest of every 1/60 s frame
+// is spent asleep. The sleep cycles per frame and the awake share of the frame
+// time are derived from that, as the energy figure of the scripted game.
+//
+// The registers watched sit at tinyAVR 0-series data addresses (GPIOR0 0x001C,
+// TWI0 0x0810...), which avr_register_io_write() cannot take - it expects the
+// classic I/O numbering, data address - 0x20. So the harness steps the core one
+// instruction at a time and decodes every store (OUT, STS, ST, STD) before it
+// executes, and handles the ones that hit a watched data address. This only
+// relies on avr->pc, avr->flash and the register file in avr->data[0..31].
+//
+// The -m core still has to model the avrxmega3 memory map (I/O from 0x0000,
+// SRAM at 0x3F80, flash mapped at 0x8000 for const data):
+//   cc -O2 -o simbench simbench.c -lsimavr -lelf
+//   ./simbench [-m attiny202] [-f 20000000] [-o bench_results.json] [-c frames.csv] firmware.elf
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+
+// tinyAVR 0-series data space addresses
+#define GPIOR0_ADDR       0x001C
+#define GPIOR1_ADDR       0x001D
+#define TWI0_MCTRLB_ADDR  0x0814
+#define TWI0_MSTATUS_ADDR 0x0815
+#define TWI0_MADDR_ADDR   0x0817
+#define TWI0_MDATA_ADDR   0x0818
+
+#define TWI_WIF_bm        0x40
+#define TWI_BUSSTATE_OWNER_gc 0x02
+#define TWI_BUSSTATE_IDLE_gc  0x01
+
+// Must match include/bench.h
+#define BENCH_FRAME           1
+#define BENCH_DRAW_TILE_ROWS  3
+#define BENCH_UPDATE_TILE_POS 5
+#define BENCH_DONE            0xFF
+#define HAL_FRAME_HZ          60                                // Must match include/hal.h
+
+#define MAX_CYCLES 2000000000ULL
+
+static const char *markerNames[256] = {
+    [1] = "frame",
+    [2] = "drawBoard",
+    [3] = "drawTileRows",
+    [4] = "tileFits",
+    [5] = "updateTilePos",
+    [6] = "addScore",
+    [7] = "keySample",
+    [8] = "boot",
+};
+
+typedef struct {
+    uint64_t start;
+    uint64_t calls;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t frame;                                             // Cycles within the current frame
+    int open;
+} marker_t;
+
+static marker_t markers[256];
+static int done = 0;
+static uint64_t twiBytes = 0;
+static uint64_t twiStarts = 0;
+static FILE *frameCsv = NULL;
+static uint64_t frameCount = 0;
+static uint64_t frameTwiBytes = 0;
+static uint64_t frameTwiStarts = 0;
+static uint64_t frameCycles = 0;                                // F_CPU / HAL_FRAME_HZ
+
+static void frameBegin(void) {
+    for (int i = 0; i < 256; i++)
+        markers[i].frame = 0;
+    frameTwiBytes = twiBytes;
+    frameTwiStarts = twiStarts;
+}
+
+static void frameEnd(void) {
+    uint64_t awake = markers[BENCH_FRAME].frame;
+    fprintf(frameCsv, "%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", (unsigned long long)frameCount++,
+        (unsigned long long)awake,
+        (unsigned long long)(awake < frameCycles ? frameCycles - awake : 0),
+        (unsigned long long)markers[BENCH_DRAW_TILE_ROWS].frame,
+        (unsigned long long)markers[BENCH_UPDATE_TILE_POS].frame,
+        (unsigned long long)(twiBytes - frameTwiBytes),
+        (unsigned long long)(twiStarts - frameTwiStarts));
+}
+
+static void onBegin(avr_t *avr, uint8_t v) {
+    if (v == BENCH_DONE) {
+        done = 1;
+        return;
+    }
+    if (v == BENCH_FRAME && frameCsv)
+        frameBegin();
+    markers[v].start = avr->cycle;
+    markers[v].open = 1;
+}
+
+static void onEnd(avr_t *avr, uint8_t v) {
+    marker_t *m = &markers[v];
+    if (!m->open)
+        return;
+
+    uint64_t cycles = avr->cycle - m->start;
+    m->open = 0;
+    m->calls++;
+    m->total += cycles;
+    if (!m->min || cycles < m->min) m->min = cycles;
+    if (cycles > m->max) m->max = cycles;
+    m->frame += cycles;
+
+    if (v == BENCH_FRAME && frameCsv)
+        frameEnd();
+}
+
+// Every START or data byte completes at once and is ACKed
+static void onTwiWrite(avr_t *avr, uint16_t addr, uint8_t v) {
+    if (addr == TWI0_MADDR_ADDR)
+        twiStarts++;
+    twiBytes++;
+    avr->data[addr] = v;
+    avr->data[TWI0_MSTATUS_ADDR] = TWI_WIF_bm | TWI_BUSSTATE_OWNER_gc;
+}
+
+static void onTwiCommand(avr_t *avr, uint16_t addr, uint8_t v) {
+    avr->data[addr] = v;
+    if ((v & 0x03) == 0x03)                                     // MCMD STOP
+        avr->data[TWI0_MSTATUS_ADDR] = TWI_BUSSTATE_IDLE_gc;
+}
+
+static void onStore(avr_t *avr, uint16_t addr, uint8_t v) {
+    switch (addr) {
+        case GPIOR0_ADDR:      onBegin(avr, v); break;
+        case GPIOR1_ADDR:      onEnd(avr, v); break;
+        case TWI0_MADDR_ADDR:
+        case TWI0_MDATA_ADDR:  onTwiWrite(avr, addr, v); break;
+        case TWI0_MCTRLB_ADDR: onTwiCommand(avr, addr, v); break;
+    }
+}
+
+static uint16_t pointerReg(avr_t *avr, uint8_t low) {
+    return avr->data[low] | (avr->data[low + 1] << 8);
+}
+
+// Data address and value of the store at the PC, 0 if it is no store. X, Y and
+// Z are read before the instruction runs, so pre-decrement is applied here.
+static int decodeStore(avr_t *avr, uint16_t *addr, uint8_t *value) {
+    const uint8_t *code = avr->flash + avr->pc;
+    uint16_t op = code[0] | (code[1] << 8);
+    uint8_t r = (op >> 4) & 0x1F;
+
+    if ((op & 0xF800) == 0xB800) {                              // OUT A, Rr - I/O space is data space
+        *addr = ((op >> 5) & 0x30) | (op & 0x0F);
+    } else if ((op & 0xFE0F) == 0x9200) {                       // STS k, Rr
+        *addr = code[2] | (code[3] << 8);
+    } else if ((op & 0xD200) == 0x8200) {                       // STD Y+q / Z+q, Rr (ST Y / ST Z)
+        uint8_t q = ((op >> 8) & 0x20) | ((op >> 7) & 0x18) | (op & 0x07);
+        *addr = pointerReg(avr, (op & 0x08) ? 28 : 30) + q;
+    } else if ((op & 0xFE00) == 0x9200) {
+        switch (op & 0x0F) {
+            case 0x1: *addr = pointerReg(avr, 30); break;       // ST Z+
+            case 0x2: *addr = pointerReg(avr, 30) - 1; break;   // ST -Z
+            case 0x9: *addr = pointerReg(avr, 28); break;       // ST Y+
+            case 0xA: *addr = pointerReg(avr, 28) - 1; break;   // ST -Y
+            case 0xC: *addr = pointerReg(avr, 26); break;       // ST X
+            case 0xD: *addr = pointerReg(avr, 26); break;       // ST X+
+            case 0xE: *addr = pointerReg(avr, 26) - 1; break;   // ST -X
+            default: return 0;                                  // PUSH and the rest
+        }
+    } else {
+        return 0;
+    }
+
+    *value = avr->data[r];
+    return 1;
+}
+
+static void writeReport(FILE *out, const char *elf, uint32_t fcpu) {
+    fprintf(out, "{\n  \"firmware\": \"%s\",\n  \"f_cpu\": %u,\n", elf, fcpu);
+    fprintf(out, "  \"twi_bytes\": %llu,\n  \"twi_starts\": %llu,\n",
+        (unsigned long long)twiBytes, (unsigned long long)twiStarts);
+
+    marker_t *frames = &markers[BENCH_FRAME];
+    fprintf(out, "  \"awake_percent\": %.3f,\n", frames->calls ?
+        100.0 * frames->total / (frames->calls * (double)frameCycles) : 0.0);
+    fprintf(out, "  \"markers\": {");
+
+    int first = 1;
+    for (int i = 0; i < 256; i++) {
+        marker_t *m = &markers[i];
+        if (!m->calls || !markerNames[i])
+            continue;
+        fprintf(out, "%s\n    \"%s\": { \"calls\": %llu, \"cycles_total\": %llu, "
+            "\"cycles_min\": %llu, \"cycles_max\": %llu, \"cycles_mean\": %.1f }",
+            first ? "" : ",", markerNames[i],
+            (unsigned long long)m->calls, (unsigned long long)m->total,
+            (unsigned long long)m->min, (unsigned long long)m->max,
+            (double)m->total / m->calls);
+        first = 0;
+    }
+    fprintf(out, "\n  }\n}\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *mcu = "attiny202";
+    const char *output = "bench_results.json";
+    const char *csv = NULL;
+    uint32_t fcpu = 20000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:f:o:c:")) != -1) {
+        switch (opt) {
+            case 'm': mcu = optarg; break;
+            case 'f': fcpu = strtoul(optarg, NULL, 0); break;
+            case 'o': output = optarg; break;
+            case 'c': csv = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-m mcu] [-f f_cpu] [-o out.json] [-c frames.csv] firmware.elf\n", argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "missing firmware.elf\n");
+        return 2;
+    }
+
+    elf_firmware_t firmware = {{0}};
+    if (elf_read_firmware(argv[optind], &firmware)) {
+        fprintf(stderr, "cannot read %s\n", argv[optind]);
+        return 1;
+    }
+
+    if (csv) {
+        if (!(frameCsv = fopen(csv, "w"))) {
+            perror(csv);
+            return 1;
+        }
+        fprintf(frameCsv, "frame,cycles,sleep_cycles,draw_tile_rows_cycles,update_tile_pos_cycles,twi_bytes,twi_starts\n");
+    }
+
+    frameCycles = fcpu / HAL_FRAME_HZ;
+
+    avr_t *avr = avr_make_mcu_by_name(mcu);
+    if (!avr) {
+        fprintf(stderr, "simavr has no core for %s\n", mcu);
+        return 1;
+    }
+    avr_init(avr);
+    avr->frequency = fcpu;
+    avr_load_firmware(avr, &firmware);
+
+    // avr_run() executes one instruction while the core is running, interrupt
+    // entry happens after it in the same call
+    int state = cpu_Running;
+    while (!done && avr->cycle < MAX_CYCLES && state != cpu_Done && state != cpu_Crashed) {
+        uint16_t addr;
+        uint8_t value;
+        int store = (avr->state == cpu_Running) && decodeStore(avr, &addr, &value);
+        state = avr_run(avr);
+        if (store)
+            onStore(avr, addr, value);
+    }
+
+    if (!done) {
+        fprintf(stderr, "firmware did not reach BENCH_DONE (state %d, %llu cycles)\n",
+            state, (unsigned long long)avr->cycle);
+        return 1;
+    }
+
+    FILE *out = fopen(output, "w");
+    if (!out) {
+        perror(output);
+        return 1;
+    }
+    writeReport(out, argv[optind], fcpu);
+    fclose(out);
+    writeReport(stdout, argv[optind], fcpu);
+    if (frameCsv)
+        fclose(frameCsv);
+
+    return 0;
+}